@@ -1,188 +1,291 @@
 #include "board.h"
-#include "gpio.h"
 #include <fcntl.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 #include <asm/ioctl.h>
 #include <linux/spi/spidev.h>
 
-#define SPIDEV0  "/dev/spidev0.0"
-#define SPIDEV1  "/dev/spidev0.1"
+#define SPIDEV   "/dev/spidev%u.%u"
 #define SPIBPW   8
-#define SPIDELAY 0
 
-#define PIN_CLOCK 0
-#define PIN_DATA 1
+// Pixels corrected and quantised per pass
+#define BOARD_BLOCK 64
 
-int board_init_spi(board_t* board, uint8_t channel, uint32_t speed)
+int board_spi_open(uint8_t bus, uint8_t cs, uint32_t speed, uint8_t* mode_out, uint8_t* bpw_out, uint32_t* speed_out)
 {
-	if (board->type != board_type_invalid)
-		return -2;
-
-	board->type = board_type_spi;
-
 	int fd;
-	channel &= 1;
+	char path[32];
+	snprintf(path, sizeof(path), SPIDEV, bus, cs);
 
-	if ((fd = open(channel == 0 ? SPIDEV0 : SPIDEV1, O_RDWR)) < 0)
+	if ((fd = open(path, O_RDWR)) < 0)
 		return -1;
 
 	uint8_t mode = SPI_MODE_0;
-	if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0) return -1;
-	if (ioctl(fd, SPI_IOC_RD_MODE, &board->spi.mode) < 0) return -1;
+	if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0) goto error;
+	if (ioctl(fd, SPI_IOC_RD_MODE, mode_out) < 0) goto error;
 
 	mode = SPIBPW;
-	if (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &mode) < 0) return -1;
-	if (ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &board->spi.bpw) < 0) return -1;
+	if (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &mode) < 0) goto error;
+	if (ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, bpw_out) < 0) goto error;
 
-	mode = speed;
-	if (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &mode) < 0) return -1;
-	if (ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &board->spi.speed) < 0) return -1;
+	if (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0) goto error;
+	if (ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, speed_out) < 0) goto error;
 
-	board->spi.delay = SPIDELAY;
-	board->spi.fd = fd;
+	return fd;
 
-	return 0;
+error:
+	close(fd);
+	return -1;
 }
-int board_init_p9813(board_t* board, uint8_t clock_pin, uint8_t data_pin, uint8_t chain_len)
+
+int board_start(board_t* board)
 {
-	if (board->type != board_type_invalid)
-		return -2;
+	if (board->ops == NULL)
+		return -1;
 
-	board->type = board_type_p9813;
+	board->quant = calloc(board_pixel_count(board), sizeof(rgb_t));
+	if (board->quant == NULL)
+		return -1;
 
-	printf("Attaching clock pin to GPIO pin %d\n", clock_pin);
-	if (gpio_export(PIN_CLOCK, clock_pin, GPIO_OUT) < 0) return -1;
-	printf("Attaching data pin to GPIO pin %d\n", data_pin);
-	if (gpio_export(PIN_DATA, data_pin, GPIO_OUT) < 0) return -1;
+	if (board->ops->init == NULL)
+		return 0;
 
-	board->p9813.clock_pin = clock_pin;
-	board->p9813.data_pin = data_pin;
-	board->p9813.chain_len = chain_len;
+	return board->ops->init(board);
+}
+int board_cleanup(board_t* board)
+{
+	if (board->ops != NULL && board->ops->cleanup != NULL)
+		board->ops->cleanup(board);
 
+	free(board->quant);
+	free(board->dither);
+	free(board->correction);
+	memset(board, 0, sizeof(board_t));
 	return 0;
 }
-int board_init_dummy(board_t* board)
+
+size_t board_pixel_count(const board_t* board)
 {
-	if (board->type != board_type_invalid)
-		return -2;
+	if (board->ops == NULL || (board->ops->caps & BOARD_CAP_PER_PIXEL) == 0)
+		return 1;
 
-	board->type = board_type_dummy;
-	return 0;
+	return board->pixels;
 }
-int board_cleanup(board_t* board)
+
+int board_get_latency(const board_t* board, board_latency_t* latency)
 {
-	if (board->type == board_type_p9813)
-	{
-		gpio_unexport(PIN_CLOCK);
-		gpio_unexport(PIN_DATA);
-	}
+	if (board->ops == NULL || board->ops->latency == NULL)
+		return -1;
 
-	if (board->type == board_type_dummy)
-		fprintf(stderr, "board_cleanup()\n");
+	return board->ops->latency(board, latency);
+}
 
-	memset(board, 0, sizeof(board_t));
-	return 0;
+int board_write_rgb(const board_t* board, const rgb_t* rgb)
+{
+	return board_write_frame(board, rgb, 1);
 }
 
-int board_set_pwm(const board_t* board)
+int board_write_frame(const board_t* board, const rgb_t* pixels, size_t n)
 {
-	if (board->type == board_type_dummy)
-		fprintf(stderr, "board_set_pwm()\n");
+	if (n == 0)
+		return 0;
+	if (board->ops == NULL)
+		return -1;
 
-	if (board->type != board_type_spi)
+	if (board->ops->write_frame(board, pixels, n) < 0)
 		return -1;
+	if (board->ops->flush == NULL)
+		return 0;
+
+	return board->ops->flush(board);
+}
 
-	char data[3];
-	data[0] = board->spi.id;
-	data[1] = 0x33;
-	data[2] = 0xFF;
+static uint8_t board_quantise(uint16_t value, uint8_t depth)
+{
+	if (depth >= 8)
+		return COLOR_16TO8(value);
 
-	return board_write_data(board, data, 3);
+	// Round to the native code, then spread it back over the 8-bit range the drivers take
+	uint32_t max = (1U << depth) - 1;
+	uint32_t code = (value * max + 32767) / 65535;
+	return code * 255 / max;
 }
 
-int board_write_data(const board_t* board, char* data, uint32_t len)
+static uint8_t board_dither(uint16_t value, uint8_t depth, uint16_t* error, int* residual)
 {
-	if (board->type == board_type_dummy)
-		fprintf(stderr, "board_write_data(%p, %u)\n", (void*)data, len);
+	uint32_t max = (1U << depth) - 1;
 
-	if (board->type != board_type_spi)
-		return -1;
+	// Exactly representable, nothing to spread over the next frames
+	if ((value * max) % 65535 == 0)
+	{
+		*error = 0;
+		return board_quantise(value, depth);
+	}
 
-	struct spi_ioc_transfer spi;
-	memset(&spi, 0, sizeof(spi));
+	// Show the code below the carried total and keep what it misses for the next frame
+	*residual = 1;
+	uint32_t total = value + *error;
+	uint32_t code = total * max / 65535;
+	if (code >= max)
+	{
+		*error = 0;
+		return 255;
+	}
+
+	*error = total - code * 65535 / max;
+	return code * 255 / max;
+}
 
-	spi.tx_buf = (unsigned long)data;
-	spi.rx_buf = (unsigned long)data;
-	spi.len    = len;
-	spi.delay_usecs   = board->spi.delay;
-	spi.speed_hz      = board->spi.speed;
-	spi.bits_per_word = board->spi.bpw;
+int board_set_dither(board_t* board, int enable)
+{
+	free(board->dither);
+	board->dither = NULL;
+	if (!enable)
+		return 0;
 
-	return ioctl(board->spi.fd, SPI_IOC_MESSAGE(1), &spi);
+	board->dither = calloc(board_pixel_count(board) * 3, sizeof(uint16_t));
+	if (board->dither == NULL)
+		return -1;
+
+	return 0;
 }
-int board_write_u32(const board_t* board, uint32_t data)
+
+int board_set_correction(board_t* board, const float* matrix, const float* gamma)
 {
-	if (board->type == board_type_dummy)
-		fprintf(stderr, "board_write_u32(%u)\n", data);
+	free(board->correction);
+	board->correction = NULL;
+	if (matrix == NULL && gamma == NULL)
+		return 0;
+
+	board_correction_t* correction = calloc(1, sizeof(board_correction_t));
+	if (correction == NULL)
+		return -1;
 
-	int val;
-	for (uint8_t bit = 0; bit < 32; ++bit)
+	if (matrix != NULL)
 	{
-		val = (data & 0x80000000) != 0 ? GPIO_HIGH : GPIO_LOW;
-		data <<= 1;
+		for (int i = 0; i < 9; ++i)
+		{
+			float coeff = roundf(matrix[i] * COLOR_CCM_ONE);
+			if (!(coeff >= -COLOR_CCM_MAX && coeff <= COLOR_CCM_MAX))
+			{
+				fprintf(stderr, "Colour correction coefficient %f is outside of -4..4\n", matrix[i]);
+				free(correction);
+				return -1;
+			}
+			correction->matrix[i] = coeff;
+		}
+		correction->has_matrix = 1;
+	}
 
-		gpio_write(PIN_DATA, val);
-		gpio_pulse(PIN_CLOCK);
+	if (gamma != NULL)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			if (!(gamma[c] > 0.f))
+			{
+				fprintf(stderr, "Gamma %f must be above 0\n", gamma[c]);
+				free(correction);
+				return -1;
+			}
+
+			// One entry past the end, so the top of the range has something to interpolate towards
+			for (int i = 0; i <= BOARD_GAMMA_SIZE; ++i)
+			{
+				float in = (float)(i << (16 - BOARD_GAMMA_BITS)) / 65535.f;
+				float out = powf(in > 1.f ? 1.f : in, gamma[c]) * 65535.f + 0.5f;
+				correction->gamma[c][i] = out > 65535.f ? 65535 : (uint16_t)out;
+			}
+		}
+		correction->has_gamma = 1;
 	}
+
+	board->correction = correction;
 	return 0;
 }
 
-int board_write_rgb(const board_t* board, const rgb_t* rgb)
+static uint16_t board_gamma(const uint16_t* curve, uint16_t value)
 {
+	uint32_t index = value >> (16 - BOARD_GAMMA_BITS);
+	int32_t frac = value & ((1 << (16 - BOARD_GAMMA_BITS)) - 1);
 
-	if (board->type == board_type_spi)
+	return curve[index] + (((curve[index + 1] - curve[index]) * frac) >> (16 - BOARD_GAMMA_BITS));
+}
+
+static void board_correct(const board_correction_t* correction, const rgb16_t* in, rgb16_t* out, size_t n)
+{
+	if (correction->has_matrix)
 	{
-		char data[6];
-		data[0] = board->spi.id;
-		data[1] = 0x58;
-		data[2] = rgb->r;
-		data[3] = rgb->g;
-		data[4] = rgb->b;
-		data[5] = 0;
-
-		return board_write_data(board, data, 6);
+		rgb16_ccm_batch(correction->matrix, in, out, n);
 	}
-	else if (board->type == board_type_p9813)
+	else
+		memcpy(out, in, n * sizeof(rgb16_t));
+
+	if (correction->has_gamma)
 	{
-		uint8_t header = (1 << 7) | (1 << 6);
-		if ((rgb->b & 0x80) == 0) header |= (1 << 5);
-		if ((rgb->b & 0x40) == 0) header |= (1 << 4);
-		if ((rgb->g & 0x80) == 0) header |= (1 << 3);
-		if ((rgb->g & 0x40) == 0) header |= (1 << 2);
-		if ((rgb->r & 0x80) == 0) header |= (1 << 1);
-		if ((rgb->r & 0x40) == 0) header |= (1 << 0);
-
-		uint32_t data = 0;
-		data |= header << 24;
-		data |= rgb->b << 16;
-		data |= rgb->g << 8;
-		data |= rgb->r << 0;
-
-		board_write_u32(board, 0);
-
-		for (uint8_t i = 0; i < board->p9813.chain_len; ++i)
-			board_write_u32(board, data);
-
-		board_write_u32(board, 0);
-		return 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			out[i].r = board_gamma(correction->gamma[0], out[i].r);
+			out[i].g = board_gamma(correction->gamma[1], out[i].g);
+			out[i].b = board_gamma(correction->gamma[2], out[i].b);
+		}
 	}
-	else if (board->type == board_type_dummy)
-	{
-		fprintf(stderr, "board_write_rgb([%u, %u, %u])\n", rgb->r, rgb->g, rgb->b);
+}
+
+int board_write_frame16(const board_t* board, const rgb16_t* pixels, size_t n)
+{
+	if (n == 0)
 		return 0;
+	if (board->ops == NULL || board->quant == NULL)
+		return -1;
+
+	size_t count = board_pixel_count(board);
+	if (n > count)
+		n = count;
+
+	// Drivers take 8 bits per channel, anything deeper is rounded down to that for now
+	uint8_t depth = board->ops->bit_depth > 0 && board->ops->bit_depth < 8 ? board->ops->bit_depth : 8;
+	int residual = 0;
+
+	// Corrected a block at a time, so the pixels are still in cache when they are quantised
+	rgb16_t block[BOARD_BLOCK];
+	for (size_t start = 0; start < n; start += BOARD_BLOCK)
+	{
+		size_t len = n - start < BOARD_BLOCK ? n - start : BOARD_BLOCK;
+		const rgb16_t* src = &pixels[start];
+		if (board->correction != NULL)
+		{
+			board_correct(board->correction, src, block, len);
+			src = block;
+		}
+
+		rgb_t* dst = &board->quant[start];
+		if (board->dither != NULL)
+		{
+			uint16_t* error = &board->dither[start * 3];
+			for (size_t i = 0; i < len; ++i, error += 3)
+			{
+				dst[i].r = board_dither(src[i].r, depth, &error[0], &residual);
+				dst[i].g = board_dither(src[i].g, depth, &error[1], &residual);
+				dst[i].b = board_dither(src[i].b, depth, &error[2], &residual);
+			}
+		}
+		else
+		{
+			for (size_t i = 0; i < len; ++i)
+			{
+				dst[i].r = board_quantise(src[i].r, depth);
+				dst[i].g = board_quantise(src[i].g, depth);
+				dst[i].b = board_quantise(src[i].b, depth);
+			}
+		}
 	}
 
-	return -1;
+	if (board_write_frame(board, board->quant, n) < 0)
+		return -1;
+
+	return residual ? 1 : 0;
 }
@@ -1,6 +1,7 @@
 #ifndef _BOARD_H
 #define _BOARD_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include "color.h"
 
@@ -9,43 +10,160 @@ enum board_type_t
 	board_type_invalid = 0,
 	board_type_spi,
 	board_type_p9813,
-	board_type_dummy
+	board_type_dummy,
+	board_type_p9813_spi
 };
 
+#define P9813_MAX_STRIPS 8
+#define SPI_MAX_BOARDS 16
+
+// Every pixel of the frame is shown, instead of only the first one
+#define BOARD_CAP_PER_PIXEL (1 << 0)
+
+struct _board_t;
+struct spi_ioc_transfer;
+
+// One BitWizard board, addressed by bus, chip-select and board id
+struct _board_spi_dev_t
+{
+	uint8_t bus, cs, id;
+};
+typedef struct _board_spi_dev_t board_spi_dev_t;
+
+struct _board_latency_t
+{
+	unsigned long flushes;
+	uint64_t last_ns, max_ns, total_ns;
+};
+typedef struct _board_latency_t board_latency_t;
+
+// Gamma curves are sampled at the top bits of a channel and interpolated in between
+#define BOARD_GAMMA_BITS 12
+#define BOARD_GAMMA_SIZE (1 << BOARD_GAMMA_BITS)
+
+// Per-fixture calibration, applied to 16-bit frames before they are quantised
+struct _board_correction_t
+{
+	// Colour correction matrix, see rgb16_ccm_batch()
+	int32_t matrix[9];
+	int has_matrix;
+
+	uint16_t gamma[3][BOARD_GAMMA_SIZE + 1];
+	int has_gamma;
+};
+typedef struct _board_correction_t board_correction_t;
+
+struct _board_spi_batch_t;
+struct _trace_t;
+struct _board_sim_t;
+
+struct _board_ops_t
+{
+	const char* name;
+
+	uint32_t caps;
+	// Highest useful update rate, 0 if only limited by the bus itself
+	uint16_t max_fps;
+	// Native depth per channel, 16-bit frames are rounded to this before write_frame
+	uint8_t bit_depth;
+
+	// Brings opened hardware to a known state, may be NULL
+	int (*init)(struct _board_t*);
+	// Encodes a frame into the board buffers, pixels past n repeat the last one
+	int (*write_frame)(const struct _board_t*, const rgb_t*, size_t);
+	// Puts the encoded buffers on the bus
+	int (*flush)(const struct _board_t*);
+	int (*cleanup)(struct _board_t*);
+	// Time spent in flush, may be NULL
+	int (*latency)(const struct _board_t*, board_latency_t*);
+};
+typedef struct _board_ops_t board_ops_t;
+
 struct _board_t
 {
 	enum board_type_t type;
+	const board_ops_t* ops;
+
+	size_t pixels;
+
+	// Quantised copy of the last 16-bit frame, one entry per pixel the board shows
+	rgb_t* quant;
+	// Temporal dithering error carried per channel between frames, NULL when off
+	uint16_t* dither;
+	// Calibration for this fixture, NULL when frames are written as given
+	board_correction_t* correction;
 
 	union
 	{
 		struct {
-			int fd;
-			uint8_t id;
+			board_spi_dev_t devs[SPI_MAX_BOARDS];
+			uint8_t count;
+
+			// One spidev per bus and chip-select, indexed per board by group
+			int fds[SPI_MAX_BOARDS];
+			uint8_t group[SPI_MAX_BOARDS];
+			uint8_t groups;
 
 			uint8_t mode;
 			uint8_t bpw;
 			uint32_t speed;
 			uint16_t delay;
+
+			// Queued register writes, flushed as one message per spidev
+			struct _board_spi_batch_t* batch;
 		} spi;
 		struct {
 			uint8_t clock_pin,
-				data_pin,
+				data_pins[P9813_MAX_STRIPS],
+				strips,
 				chain_len;
+
+			// Clock and data requested as one multi-line handle
+			uint8_t lines;
+
+			// Encoded bitstream per strip; start frame, one word per IC, end frame
+			uint32_t* frame;
 		} p9813;
+		struct {
+			int fd;
+			uint32_t speed;
+			uint8_t chain_len;
+
+			// Big-endian bitstream, clocked out as one transfer
+			uint8_t* frame;
+			uint32_t frame_len;
+		} p9813_spi;
+		struct {
+			// Recorded frames, NULL when only logging
+			struct _trace_t* trace;
+			// Modelled bus timing, NULL when writes are instant
+			struct _board_sim_t* sim;
+		} dummy;
 	};
 };
 typedef struct _board_t board_t;
 
-int board_init_spi(board_t*, uint8_t channel, uint32_t speed);
-int board_init_p9813(board_t*, uint8_t clock_pin, uint8_t data_pin, uint8_t chain_len);
+int board_init_spi(board_t*, const board_spi_dev_t* devs, uint8_t count, uint32_t speed);
+int board_init_p9813(board_t*, uint8_t clock_pin, const uint8_t* data_pins, uint8_t strips, uint8_t chain_len, uint32_t clock_hz);
+int board_init_p9813_spi(board_t*, uint8_t bus, uint8_t cs, uint32_t speed, uint8_t chain_len);
 int board_init_dummy(board_t*);
+int board_init_dummy_trace(board_t*, const char* path, size_t pixels, uint32_t frames);
+int board_init_dummy_sim(board_t*, const char* model, size_t pixels, uint32_t clock_hz, int virtual_time);
+int board_start(board_t*);
 int board_cleanup(board_t*);
 
-int board_set_pwm(const board_t*);
-
-int board_write_data(const board_t*, char*, uint32_t);
-int board_write_u32(const board_t*, uint32_t data);
+size_t board_pixel_count(const board_t*);
+int board_get_latency(const board_t*, board_latency_t*);
 
 int board_write_rgb(const board_t*, const rgb_t*);
+int board_write_frame(const board_t*, const rgb_t* pixels, size_t n);
+// Returns 1 when dithering left a residual, the frame should then be written again
+int board_write_frame16(const board_t*, const rgb16_t* pixels, size_t n);
+int board_set_dither(board_t*, int enable);
+// Row-major 3x3 matrix and per-channel gamma, either may be NULL to leave it out
+int board_set_correction(board_t*, const float* matrix, const float* gamma);
+
+// Shared between the SPI connected drivers
+int board_spi_open(uint8_t bus, uint8_t cs, uint32_t speed, uint8_t* mode, uint8_t* bpw, uint32_t* real_speed);
 
 #endif
@@ -0,0 +1,247 @@
+#include "board.h"
+#include "trace.h"
+#include "gpio.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct _board_sim_t
+{
+	const char* model;
+
+	uint32_t clock_hz;
+	// Start/end frames or command bytes, on top of the pixel bits
+	uint32_t frame_bits;
+	uint32_t pixel_bits;
+	// Fixed cost of one transfer; syscall, DMA setup, chip-select gaps
+	uint32_t transfer_ns;
+	// Cost of setting one clock edge, a bit-banged half-period is never shorter
+	uint32_t edge_ns;
+
+	int virtual_time;
+	board_latency_t latency;
+};
+typedef struct _board_sim_t board_sim_t;
+
+// Rough figures for the real drivers on a Raspberry Pi
+static const board_sim_t sim_models[] = {
+	{ .model = "p9813", .clock_hz = GPIO_DEFAULT_CLOCK_HZ, .frame_bits = 64, .pixel_bits = 32, .transfer_ns = 0, .edge_ns = 2000 },
+	{ .model = "p9813-spi", .clock_hz = 1000000, .frame_bits = 64, .pixel_bits = 32, .transfer_ns = 30000, .edge_ns = 0 },
+	{ .model = "spi", .clock_hz = 100000, .frame_bits = 0, .pixel_bits = 48, .transfer_ns = 30000, .edge_ns = 0 },
+};
+
+static int dummy_init(board_t*);
+static int dummy_write_frame(const board_t*, const rgb_t*, size_t);
+static int dummy_cleanup(board_t*);
+
+static int dummy_trace_write_frame(const board_t*, const rgb_t*, size_t);
+static int dummy_trace_cleanup(board_t*);
+
+static int dummy_sim_write_frame(const board_t*, const rgb_t*, size_t);
+static int dummy_sim_flush(const board_t*);
+static int dummy_sim_cleanup(board_t*);
+static int dummy_sim_latency(const board_t*, board_latency_t*);
+
+static const board_ops_t dummy_ops = {
+	.name = "Dummy",
+	.caps = 0,
+	.max_fps = 0,
+	.bit_depth = 8,
+
+	.init = dummy_init,
+	.write_frame = dummy_write_frame,
+	.flush = NULL,
+	.cleanup = dummy_cleanup
+};
+
+static const board_ops_t dummy_trace_ops = {
+	.name = "Recording dummy",
+	.caps = BOARD_CAP_PER_PIXEL,
+	.max_fps = 0,
+	.bit_depth = 8,
+
+	.init = NULL,
+	.write_frame = dummy_trace_write_frame,
+	.flush = NULL,
+	.cleanup = dummy_trace_cleanup
+};
+
+static const board_ops_t dummy_sim_ops = {
+	.name = "Simulated bus",
+	.caps = BOARD_CAP_PER_PIXEL,
+	.max_fps = 0,
+	.bit_depth = 8,
+
+	.init = NULL,
+	.write_frame = dummy_sim_write_frame,
+	.flush = dummy_sim_flush,
+	.cleanup = dummy_sim_cleanup,
+	.latency = dummy_sim_latency
+};
+
+int board_init_dummy(board_t* board)
+{
+	if (board->type != board_type_invalid)
+		return -2;
+
+	board->type = board_type_dummy;
+	board->ops = &dummy_ops;
+	board->pixels = 1;
+	board->dummy.trace = NULL;
+	board->dummy.sim = NULL;
+	return 0;
+}
+
+int board_init_dummy_trace(board_t* board, const char* path, size_t pixels, uint32_t frames)
+{
+	if (board->type != board_type_invalid)
+		return -2;
+
+	board->type = board_type_dummy;
+	board->ops = &dummy_trace_ops;
+	board->pixels = pixels;
+
+	board->dummy.sim = NULL;
+	board->dummy.trace = malloc(sizeof(trace_t));
+	if (board->dummy.trace == NULL)
+		return -1;
+
+	if (trace_create(board->dummy.trace, path, pixels, frames) < 0)
+	{
+		free(board->dummy.trace);
+		board->dummy.trace = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int board_init_dummy_sim(board_t* board, const char* model, size_t pixels, uint32_t clock_hz, int virtual_time)
+{
+	if (board->type != board_type_invalid)
+		return -2;
+
+	const board_sim_t* preset = NULL;
+	for (size_t i = 0; i < sizeof(sim_models) / sizeof(sim_models[0]); ++i)
+		if (strcmp(sim_models[i].model, model) == 0)
+			preset = &sim_models[i];
+
+	if (preset == NULL)
+	{
+		fprintf(stderr, "Unknown bus model %s, expected p9813, p9813-spi or spi\n", model);
+		return -1;
+	}
+
+	board->type = board_type_dummy;
+	board->ops = &dummy_sim_ops;
+	board->pixels = pixels;
+	board->dummy.trace = NULL;
+
+	board_sim_t* sim = malloc(sizeof(board_sim_t));
+	board->dummy.sim = sim;
+	if (sim == NULL)
+		return -1;
+
+	*sim = *preset;
+	if (clock_hz > 0)
+		sim->clock_hz = clock_hz;
+	sim->virtual_time = virtual_time;
+
+	return 0;
+}
+
+static int dummy_init(board_t* board)
+{
+	(void)board;
+
+	fprintf(stderr, "board_start()\n");
+	return 0;
+}
+
+static int dummy_write_frame(const board_t* board, const rgb_t* pixels, size_t n)
+{
+	(void)board;
+
+	fprintf(stderr, "board_write_frame(%zu)\n", n);
+	for (size_t i = 0; i < n; ++i)
+		fprintf(stderr, "  [%zu] = [%u, %u, %u]\n", i, pixels[i].r, pixels[i].g, pixels[i].b);
+	return 0;
+}
+
+static int dummy_cleanup(board_t* board)
+{
+	(void)board;
+
+	fprintf(stderr, "board_cleanup()\n");
+	return 0;
+}
+
+static int dummy_trace_write_frame(const board_t* board, const rgb_t* pixels, size_t n)
+{
+	trace_append(board->dummy.trace, pixels, n);
+	return 0;
+}
+
+static int dummy_trace_cleanup(board_t* board)
+{
+	if (board->dummy.trace == NULL)
+		return 0;
+
+	trace_close(board->dummy.trace);
+	free(board->dummy.trace);
+
+	return 0;
+}
+
+static int dummy_sim_write_frame(const board_t* board, const rgb_t* pixels, size_t n)
+{
+	(void)board;
+	(void)pixels;
+	(void)n;
+
+	return 0;
+}
+
+static int dummy_sim_flush(const board_t* board)
+{
+	board_sim_t* sim = board->dummy.sim;
+
+	uint64_t bits = sim->frame_bits + (uint64_t)board->pixels * sim->pixel_bits;
+	uint64_t half_period = 1000000000ULL / (2 * sim->clock_hz);
+	if (half_period < sim->edge_ns)
+		half_period = sim->edge_ns;
+	uint64_t ns = sim->transfer_ns + bits * 2 * half_period;
+
+	if (!sim->virtual_time)
+	{
+		struct timespec duration;
+		duration.tv_sec = ns / 1000000000ULL;
+		duration.tv_nsec = ns % 1000000000ULL;
+		while (nanosleep(&duration, &duration) < 0 && errno == EINTR)
+			;
+	}
+
+	// In virtual time the bus only accumulates busy time, without blocking
+	sim->latency.flushes++;
+	sim->latency.last_ns = ns;
+	sim->latency.total_ns += ns;
+	if (ns > sim->latency.max_ns)
+		sim->latency.max_ns = ns;
+
+	return 0;
+}
+
+static int dummy_sim_cleanup(board_t* board)
+{
+	free(board->dummy.sim);
+
+	return 0;
+}
+
+static int dummy_sim_latency(const board_t* board, board_latency_t* latency)
+{
+	*latency = board->dummy.sim->latency;
+	return 0;
+}
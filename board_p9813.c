@@ -0,0 +1,272 @@
+#include "board.h"
+#include "gpio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <asm/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#define SPIBPW   8
+
+#define PIN_CLOCK 0
+#define PIN_DATA 1
+
+static int p9813_write_frame(const board_t*, const rgb_t*, size_t);
+static int p9813_flush(const board_t*);
+static int p9813_cleanup(board_t*);
+
+static int p9813_spi_write_frame(const board_t*, const rgb_t*, size_t);
+static int p9813_spi_flush(const board_t*);
+static int p9813_spi_cleanup(board_t*);
+
+static const board_ops_t p9813_ops = {
+	.name = "P9813 GPIO",
+	.caps = BOARD_CAP_PER_PIXEL,
+	.max_fps = 0,
+	.bit_depth = 8,
+
+	.init = NULL,
+	.write_frame = p9813_write_frame,
+	.flush = p9813_flush,
+	.cleanup = p9813_cleanup
+};
+
+static const board_ops_t p9813_spi_ops = {
+	.name = "P9813 SPI",
+	.caps = BOARD_CAP_PER_PIXEL,
+	.max_fps = 0,
+	.bit_depth = 8,
+
+	.init = NULL,
+	.write_frame = p9813_spi_write_frame,
+	.flush = p9813_spi_flush,
+	.cleanup = p9813_spi_cleanup
+};
+
+int board_init_p9813(board_t* board, uint8_t clock_pin, const uint8_t* data_pins, uint8_t strips, uint8_t chain_len, uint32_t clock_hz)
+{
+	if (board->type != board_type_invalid)
+		return -2;
+	if (strips == 0 || strips > P9813_MAX_STRIPS)
+		return -1;
+
+	board->type = board_type_p9813;
+	board->ops = &p9813_ops;
+	board->pixels = (size_t)strips * chain_len;
+
+	int pins[GPIO_PINS];
+	pins[PIN_CLOCK] = clock_pin;
+	for (uint8_t i = 0; i < strips; ++i)
+		pins[PIN_DATA + i] = data_pins[i];
+
+	printf("Attaching clock and %d data pin(s) as one set of GPIO lines\n", strips);
+	if (gpio_export_lines(pins, strips + 1, GPIO_OUT) == 0)
+		board->p9813.lines = 1;
+	else
+	{
+		printf("Falling back to one GPIO handle per pin\n");
+		printf("Attaching clock pin to GPIO pin %d\n", clock_pin);
+		if (gpio_export(PIN_CLOCK, clock_pin, GPIO_OUT) < 0) return -1;
+		for (uint8_t i = 0; i < strips; ++i)
+		{
+			printf("Attaching data pin %d to GPIO pin %d\n", i, data_pins[i]);
+			if (gpio_export(PIN_DATA + i, data_pins[i], GPIO_OUT) < 0) return -1;
+		}
+		board->p9813.lines = 0;
+	}
+
+	board->p9813.clock_pin = clock_pin;
+	memcpy(board->p9813.data_pins, data_pins, strips);
+	board->p9813.strips = strips;
+	board->p9813.chain_len = chain_len;
+
+	board->p9813.frame = calloc((size_t)strips * (chain_len + 2), sizeof(uint32_t));
+	if (board->p9813.frame == NULL)
+		return -1;
+
+	if (gpio_calibrate(PIN_CLOCK, clock_hz) < 0)
+		return -1;
+
+	return 0;
+}
+int board_init_p9813_spi(board_t* board, uint8_t bus, uint8_t cs, uint32_t speed, uint8_t chain_len)
+{
+	if (board->type != board_type_invalid)
+		return -2;
+
+	board->type = board_type_p9813_spi;
+	board->ops = &p9813_spi_ops;
+	board->pixels = chain_len;
+
+	uint8_t mode, bpw;
+	int fd = board_spi_open(bus, cs, speed, &mode, &bpw, &board->p9813_spi.speed);
+	if (fd < 0)
+		return -1;
+
+	board->p9813_spi.fd = fd;
+	board->p9813_spi.chain_len = chain_len;
+	board->p9813_spi.frame_len = (chain_len + 2) * 4;
+	board->p9813_spi.frame = calloc(board->p9813_spi.frame_len, 1);
+	if (board->p9813_spi.frame == NULL)
+		return -1;
+
+	return 0;
+}
+
+// Shifts out one word per strip in parallel, all strips share the clock
+static int p9813_shift_words(const board_t* board, const uint32_t* words)
+{
+	uint8_t strips = board->p9813.strips;
+	uint64_t data_mask = (GPIO_LINE(PIN_DATA + strips) - 1) & ~GPIO_LINE(PIN_CLOCK);
+
+	if (board->p9813.lines)
+	{
+		// The IC latches data on the rising clock edge
+		for (int bit = 31; bit >= 0; --bit)
+		{
+			uint64_t val = 0;
+			for (uint8_t s = 0; s < strips; ++s)
+				val |= (uint64_t)((words[s] >> bit) & 1) << (PIN_DATA + s);
+
+			if (gpio_pulse_lines(val, data_mask, GPIO_LINE(PIN_CLOCK)) < 0)
+				return -1;
+		}
+		return 0;
+	}
+
+	for (int bit = 31; bit >= 0; --bit)
+	{
+		for (uint8_t s = 0; s < strips; ++s)
+			if (gpio_write(PIN_DATA + s, ((words[s] >> bit) & 1) ? GPIO_HIGH : GPIO_LOW) < 0)
+				return -1;
+		if (gpio_pulse(PIN_CLOCK) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static uint32_t p9813_encode(const rgb_t* rgb)
+{
+	uint8_t header = (1 << 7) | (1 << 6);
+	if ((rgb->b & 0x80) == 0) header |= (1 << 5);
+	if ((rgb->b & 0x40) == 0) header |= (1 << 4);
+	if ((rgb->g & 0x80) == 0) header |= (1 << 3);
+	if ((rgb->g & 0x40) == 0) header |= (1 << 2);
+	if ((rgb->r & 0x80) == 0) header |= (1 << 1);
+	if ((rgb->r & 0x40) == 0) header |= (1 << 0);
+
+	uint32_t data = 0;
+	data |= (uint32_t)header << 24;
+	data |= rgb->b << 16;
+	data |= rgb->g << 8;
+	data |= rgb->r << 0;
+
+	return data;
+}
+
+static int p9813_write_frame(const board_t* board, const rgb_t* pixels, size_t n)
+{
+	size_t len = board->p9813.chain_len;
+	size_t words = len + 2;
+	if (n > board->pixels)
+		n = board->pixels;
+
+	// Pixels run strip after strip, each strip has its own start and end frame
+	uint32_t data = 0;
+	for (size_t i = 0; i < board->pixels; ++i)
+	{
+		if (i < n)
+			data = p9813_encode(&pixels[i]);
+
+		board->p9813.frame[(i / len) * words + (i % len) + 1] = data;
+	}
+
+	return 0;
+}
+static int p9813_flush(const board_t* board)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	uint8_t strips = board->p9813.strips;
+	size_t words = board->p9813.chain_len + 2;
+	uint32_t column[P9813_MAX_STRIPS];
+	for (size_t i = 0; i < words; ++i)
+	{
+		for (uint8_t s = 0; s < strips; ++s)
+			column[s] = board->p9813.frame[s * words + i];
+
+		// The rest of the frame would only land shifted on the chain
+		if (p9813_shift_words(board, column) < 0)
+			return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	gpio_timing_record(words * 32, (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL + (end.tv_nsec - start.tv_nsec));
+
+	return 0;
+}
+static int p9813_cleanup(board_t* board)
+{
+	if (board->p9813.lines)
+		gpio_unexport_lines();
+	else
+	{
+		gpio_unexport(PIN_CLOCK);
+		for (uint8_t i = 0; i < board->p9813.strips; ++i)
+			gpio_unexport(PIN_DATA + i);
+	}
+
+	free(board->p9813.frame);
+
+	return 0;
+}
+
+static void p9813_spi_store(const board_t* board, size_t ic, uint32_t data)
+{
+	uint8_t* word = &board->p9813_spi.frame[(ic + 1) * 4];
+	word[0] = data >> 24;
+	word[1] = data >> 16;
+	word[2] = data >> 8;
+	word[3] = data;
+}
+static int p9813_spi_write_frame(const board_t* board, const rgb_t* pixels, size_t n)
+{
+	uint8_t len = board->p9813_spi.chain_len;
+	if (n > len)
+		n = len;
+
+	uint32_t data = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		data = p9813_encode(&pixels[i]);
+		p9813_spi_store(board, i, data);
+	}
+	for (size_t i = n; i < len; ++i)
+		p9813_spi_store(board, i, data);
+
+	return 0;
+}
+static int p9813_spi_flush(const board_t* board)
+{
+	struct spi_ioc_transfer spi;
+	memset(&spi, 0, sizeof(spi));
+
+	// Start frame, pixel words and end frame all go out in one transfer
+	spi.tx_buf = (unsigned long)board->p9813_spi.frame;
+	spi.len    = board->p9813_spi.frame_len;
+	spi.speed_hz      = board->p9813_spi.speed;
+	spi.bits_per_word = SPIBPW;
+
+	return ioctl(board->p9813_spi.fd, SPI_IOC_MESSAGE(1), &spi);
+}
+static int p9813_spi_cleanup(board_t* board)
+{
+	close(board->p9813_spi.fd);
+	free(board->p9813_spi.frame);
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+#include "board.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <asm/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#define SPIDELAY 0
+
+#define SPI_CMD_PWM_LEN 3
+#define SPI_CMD_RGB_LEN 6
+
+// Queued transfers per spidev, enough for a PWM and an RGB write to every board
+#define SPI_BATCH_LEN (2 * SPI_MAX_BOARDS)
+#define SPI_BATCH_CMD_MAX 8
+
+struct _board_spi_batch_t
+{
+	// SPI_BATCH_LEN transfers and SPI_BATCH_CMD_MAX bytes per transfer, for each spidev
+	struct spi_ioc_transfer* xfers;
+	char* tx;
+	uint8_t queued[SPI_MAX_BOARDS];
+
+	board_latency_t latency;
+};
+typedef struct _board_spi_batch_t board_spi_batch_t;
+
+static int spi_init(board_t*);
+static int spi_write_frame(const board_t*, const rgb_t*, size_t);
+static int spi_flush(const board_t*);
+static int spi_cleanup(board_t*);
+static int spi_latency(const board_t*, board_latency_t*);
+
+static const board_ops_t spi_ops = {
+	.name = "BitWizard SPI",
+	.caps = BOARD_CAP_PER_PIXEL,
+	.max_fps = 100,
+	.bit_depth = 8,
+
+	.init = spi_init,
+	.write_frame = spi_write_frame,
+	.flush = spi_flush,
+	.cleanup = spi_cleanup,
+	.latency = spi_latency
+};
+
+int board_init_spi(board_t* board, const board_spi_dev_t* devs, uint8_t count, uint32_t speed)
+{
+	if (board->type != board_type_invalid)
+		return -2;
+	if (count == 0 || count > SPI_MAX_BOARDS)
+		return -1;
+
+	board->type = board_type_spi;
+	board->ops = &spi_ops;
+	board->pixels = count;
+
+	board->spi.count = count;
+	board->spi.groups = 0;
+	memcpy(board->spi.devs, devs, count * sizeof(board_spi_dev_t));
+
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		// Boards behind the same chip-select share one spidev
+		uint8_t g;
+		for (g = 0; g < i; ++g)
+			if (devs[g].bus == devs[i].bus && devs[g].cs == devs[i].cs)
+				break;
+
+		if (g < i)
+		{
+			board->spi.group[i] = board->spi.group[g];
+			continue;
+		}
+
+		int fd = board_spi_open(devs[i].bus, devs[i].cs, speed, &board->spi.mode, &board->spi.bpw, &board->spi.speed);
+		if (fd < 0)
+			return -1;
+
+		board->spi.group[i] = board->spi.groups;
+		board->spi.fds[board->spi.groups++] = fd;
+	}
+
+	board->spi.delay = SPIDELAY;
+
+	board_spi_batch_t* batch = calloc(1, sizeof(board_spi_batch_t));
+	board->spi.batch = batch;
+	if (batch == NULL)
+		return -1;
+
+	batch->xfers = calloc(board->spi.groups * SPI_BATCH_LEN, sizeof(struct spi_ioc_transfer));
+	batch->tx = calloc(board->spi.groups * SPI_BATCH_LEN, SPI_BATCH_CMD_MAX);
+	if (batch->xfers == NULL || batch->tx == NULL)
+		return -1;
+
+	return 0;
+}
+
+static int spi_queue(const board_t* board, uint8_t dev, const char* cmd, uint32_t len)
+{
+	if (dev >= board->spi.count || len > SPI_BATCH_CMD_MAX)
+		return -1;
+
+	board_spi_batch_t* batch = board->spi.batch;
+	uint8_t g = board->spi.group[dev];
+	if (batch->queued[g] >= SPI_BATCH_LEN)
+		return -1;
+
+	size_t slot = g * SPI_BATCH_LEN + batch->queued[g]++;
+	char* tx = &batch->tx[slot * SPI_BATCH_CMD_MAX];
+	memcpy(tx, cmd, len);
+
+	struct spi_ioc_transfer* spi = &batch->xfers[slot];
+	memset(spi, 0, sizeof(*spi));
+	spi->tx_buf = (unsigned long)tx;
+	spi->len    = len;
+	spi->delay_usecs   = board->spi.delay;
+	spi->speed_hz      = board->spi.speed;
+	spi->bits_per_word = board->spi.bpw;
+	// Deselect between commands so each one is parsed on its own
+	spi->cs_change = 1;
+
+	return 0;
+}
+
+static int spi_flush(const board_t* board)
+{
+	board_spi_batch_t* batch = board->spi.batch;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int ret = 0;
+	for (uint8_t g = 0; g < board->spi.groups; ++g)
+	{
+		uint8_t n = batch->queued[g];
+		if (n == 0)
+			continue;
+
+		struct spi_ioc_transfer* xfers = &batch->xfers[g * SPI_BATCH_LEN];
+		// The chip-select is released after the message in any case
+		xfers[n - 1].cs_change = 0;
+
+		if (ioctl(board->spi.fds[g], SPI_IOC_MESSAGE(n), xfers) < 0)
+			ret = -1;
+
+		batch->queued[g] = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	uint64_t ns = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL + (end.tv_nsec - start.tv_nsec);
+	batch->latency.flushes++;
+	batch->latency.last_ns = ns;
+	batch->latency.total_ns += ns;
+	if (ns > batch->latency.max_ns)
+		batch->latency.max_ns = ns;
+
+	return ret;
+}
+
+static int spi_init(board_t* board)
+{
+	// Only queued, goes out together with the first frame
+	for (uint8_t i = 0; i < board->spi.count; ++i)
+	{
+		char data[SPI_CMD_PWM_LEN];
+		data[0] = board->spi.devs[i].id;
+		data[1] = 0x33;
+		data[2] = 0xFF;
+
+		if (spi_queue(board, i, data, SPI_CMD_PWM_LEN) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int spi_write_frame(const board_t* board, const rgb_t* pixels, size_t n)
+{
+	for (uint8_t i = 0; i < board->spi.count; ++i)
+	{
+		const rgb_t* rgb = &pixels[i < n ? i : n - 1];
+
+		char data[SPI_CMD_RGB_LEN];
+		data[0] = board->spi.devs[i].id;
+		data[1] = 0x58;
+		data[2] = rgb->r;
+		data[3] = rgb->g;
+		data[4] = rgb->b;
+		data[5] = 0;
+
+		if (spi_queue(board, i, data, SPI_CMD_RGB_LEN) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int spi_cleanup(board_t* board)
+{
+	for (uint8_t g = 0; g < board->spi.groups; ++g)
+		close(board->spi.fds[g]);
+
+	if (board->spi.batch != NULL)
+	{
+		free(board->spi.batch->xfers);
+		free(board->spi.batch->tx);
+		free(board->spi.batch);
+	}
+
+	return 0;
+}
+
+static int spi_latency(const board_t* board, board_latency_t* latency)
+{
+	*latency = board->spi.batch->latency;
+	return 0;
+}
@@ -0,0 +1,586 @@
+// Drives the board drivers against fake devices, defining open() and ioctl()
+// here puts them in front of the C library for every object linked in
+#include "board.h"
+#include "gpio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define FAKE_GPIOCHIP "/dev/gpiochip0"
+#define FAKE_SPIDEV "/dev/spidev0.0"
+#define FAKE_LINES 64
+#define FAKE_FDS 1024
+
+struct fake_gpio_t
+{
+	// Refuse v2 line requests, so drivers fall back to one v1 handle per pin
+	int v1_only;
+
+	// Chip offset behind each bit of the v2 request, and behind each v1 handle
+	uint32_t offsets[GPIO_PINS];
+	uint8_t count;
+	int handle_offset[FAKE_FDS];
+
+	unsigned long set_ioctls;
+	uint8_t level[FAKE_LINES];
+
+	// Data lines sampled on every rising clock edge, shifted in MSB first
+	int clock, data[P9813_MAX_STRIPS];
+	uint8_t strips;
+	uint32_t shift[P9813_MAX_STRIPS];
+	unsigned int bits;
+	uint32_t words[P9813_MAX_STRIPS][16];
+	unsigned int word_count;
+};
+
+static struct fake_gpio_t fake;
+
+// Every transfer is appended to a file, so the bytes on the wire can be read back
+struct fake_spi_t
+{
+	const char* path;
+	int fd;
+	uint32_t speed;
+	unsigned long messages;
+};
+
+static struct fake_spi_t fake_spi = { .fd = -1 };
+
+// What one write of the lines left in the set and clear registers of both banks
+struct fake_mem_event_t
+{
+	uint32_t set[2], clr[2];
+};
+
+#define FAKE_MEM_EVENTS 512
+
+// The register block is a plain file. Clock edges read the time before and while
+// holding each level, so every write is picked up there before the next one lands
+struct fake_mem_t
+{
+	volatile uint32_t* regs;
+	const gpio_regmap_t* map;
+
+	struct fake_mem_event_t events[FAKE_MEM_EVENTS];
+	unsigned int count;
+};
+
+static struct fake_mem_t fake_mem;
+
+static void fake_mem_sample()
+{
+	volatile uint32_t* set = &fake_mem.regs[fake_mem.map->set / 4];
+	volatile uint32_t* clr = &fake_mem.regs[fake_mem.map->clr / 4];
+	if ((set[0] | set[1] | clr[0] | clr[1]) == 0)
+		return;
+
+	if (fake_mem.count < FAKE_MEM_EVENTS)
+	{
+		struct fake_mem_event_t* event = &fake_mem.events[fake_mem.count];
+		event->set[0] = set[0];
+		event->set[1] = set[1];
+		event->clr[0] = clr[0];
+		event->clr[1] = clr[1];
+	}
+	fake_mem.count++;
+
+	set[0] = set[1] = clr[0] = clr[1] = 0;
+}
+
+int clock_gettime(clockid_t clock, struct timespec* ts)
+{
+	if (fake_mem.regs != NULL)
+		fake_mem_sample();
+
+	return syscall(SYS_clock_gettime, clock, ts);
+}
+
+static void fake_set(uint32_t offset, int value)
+{
+	if (offset >= FAKE_LINES)
+		return;
+
+	int rising = (int)offset == fake.clock && !fake.level[offset] && value;
+	fake.level[offset] = value;
+	if (!rising || fake.strips == 0)
+		return;
+
+	for (uint8_t s = 0; s < fake.strips; ++s)
+		fake.shift[s] = (fake.shift[s] << 1) | fake.level[fake.data[s]];
+
+	if (++fake.bits % 32 == 0 && fake.word_count < 16)
+	{
+		for (uint8_t s = 0; s < fake.strips; ++s)
+			fake.words[s][fake.word_count] = fake.shift[s];
+		fake.word_count++;
+	}
+}
+
+static int fake_null()
+{
+	return syscall(SYS_openat, AT_FDCWD, "/dev/null", O_RDWR, 0);
+}
+
+int open(const char* path, int flags, ...)
+{
+	mode_t mode = 0;
+	if (flags & O_CREAT)
+	{
+		va_list args;
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+
+	if (strcmp(path, FAKE_GPIOCHIP) == 0)
+		return fake_null();
+	if (strcmp(path, FAKE_SPIDEV) == 0 && fake_spi.path != NULL)
+	{
+		fake_spi.fd = syscall(SYS_openat, AT_FDCWD, fake_spi.path, O_WRONLY | O_TRUNC, 0);
+		return fake_spi.fd;
+	}
+
+	return syscall(SYS_openat, AT_FDCWD, path, flags, mode);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list args;
+	va_start(args, request);
+	void* arg = va_arg(args, void*);
+	va_end(args);
+
+	if (fd >= 0 && fd == fake_spi.fd)
+	{
+		switch (request)
+		{
+		case SPI_IOC_WR_MODE:
+		case SPI_IOC_WR_BITS_PER_WORD:
+			return 0;
+		case SPI_IOC_RD_MODE:
+			*(uint8_t*)arg = SPI_MODE_0;
+			return 0;
+		case SPI_IOC_RD_BITS_PER_WORD:
+			*(uint8_t*)arg = 8;
+			return 0;
+		case SPI_IOC_WR_MAX_SPEED_HZ:
+			fake_spi.speed = *(const uint32_t*)arg;
+			return 0;
+		case SPI_IOC_RD_MAX_SPEED_HZ:
+			*(uint32_t*)arg = fake_spi.speed;
+			return 0;
+
+		case SPI_IOC_MESSAGE(1):
+		{
+			const struct spi_ioc_transfer* xfer = arg;
+			fake_spi.messages++;
+			if (write(fd, (const void*)(uintptr_t)xfer->tx_buf, xfer->len) != (ssize_t)xfer->len)
+				return -1;
+			return xfer->len;
+		}
+		}
+
+		errno = ENOTTY;
+		return -1;
+	}
+
+	switch (request)
+	{
+	case GPIO_GET_CHIPINFO_IOCTL:
+	{
+		struct gpiochip_info* info = arg;
+		memset(info, 0, sizeof(*info));
+		snprintf(info->name, sizeof(info->name), "gpiochip0");
+		snprintf(info->label, sizeof(info->label), "fake");
+		info->lines = FAKE_LINES;
+		return 0;
+	}
+
+	case GPIO_GET_LINEHANDLE_IOCTL:
+	{
+		struct gpiohandle_request* req = arg;
+		req->fd = fake_null();
+		if (req->fd < 0 || req->fd >= FAKE_FDS)
+			return -1;
+		fake.handle_offset[req->fd] = req->lineoffsets[0];
+		return 0;
+	}
+
+	case GPIOHANDLE_SET_LINE_VALUES_IOCTL:
+	{
+		const struct gpiohandle_data* data = arg;
+		fake.set_ioctls++;
+		fake_set(fake.handle_offset[fd], data->values[0]);
+		return 0;
+	}
+
+	case GPIO_V2_GET_LINE_IOCTL:
+	{
+		struct gpio_v2_line_request* req = arg;
+		if (fake.v1_only)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+
+		memcpy(fake.offsets, req->offsets, req->num_lines * sizeof(uint32_t));
+		fake.count = req->num_lines;
+		req->fd = fake_null();
+		return req->fd < 0 ? -1 : 0;
+	}
+
+	case GPIO_V2_LINE_SET_VALUES_IOCTL:
+	{
+		const struct gpio_v2_line_values* values = arg;
+		fake.set_ioctls++;
+
+		for (uint8_t i = 0; i < fake.count; ++i)
+			if (values->mask & GPIO_LINE(i))
+				fake_set(fake.offsets[i], (values->bits >> i) & 1);
+		return 0;
+	}
+	}
+
+	return syscall(SYS_ioctl, fd, request, arg);
+}
+
+static const rgb_t test_pixels[] = {
+	{ 255, 0, 0 },
+	{ 0, 128, 64 },
+	{ 1, 2, 3 },
+	{ 255, 255, 255 },
+};
+
+// Worked out by hand from the datasheet; two flag bits, the inverted top two bits of
+// blue, green and red, then blue, green and red. Start and end frames are all zeroes.
+static const uint32_t test_words[] = {
+	0xFC0000FF,
+	0xE7408000,
+	0xFF030201,
+	0xC0FFFFFF,
+};
+
+static int gpio_run(const char* name, int v1_only, unsigned long* ioctls)
+{
+	static const uint8_t data_pins[] = { 5, 6 };
+	uint8_t strips = 2, chain_len = 2;
+
+	memset(&fake, 0, sizeof(fake));
+	fake.v1_only = v1_only;
+
+	board_t board;
+	memset(&board, 0, sizeof(board));
+	if (gpio_init(0) < 0 || board_init_p9813(&board, 4, data_pins, strips, chain_len, GPIO_DEFAULT_CLOCK_HZ) < 0)
+	{
+		fprintf(stderr, "%s: failed to set up the fake gpiochip\n", name);
+		return -1;
+	}
+	if (board.p9813.lines == v1_only)
+	{
+		fprintf(stderr, "%s: driver picked the wrong line interface\n", name);
+		return -1;
+	}
+
+	// Only the frame counts, not the calibration pulses
+	fake.set_ioctls = 0;
+	fake.clock = 4;
+	fake.data[0] = data_pins[0];
+	fake.data[1] = data_pins[1];
+	fake.strips = strips;
+
+	int ret = 0;
+	if (board_write_frame(&board, test_pixels, 4) < 0)
+	{
+		fprintf(stderr, "%s: frame write failed\n", name);
+		ret = -1;
+	}
+
+	*ioctls = fake.set_ioctls;
+
+	// Each strip gets its start frame, its two pixels and its end frame
+	unsigned int words = chain_len + 2;
+	if (ret == 0 && fake.word_count != words)
+	{
+		fprintf(stderr, "%s: %u words shifted out instead of %u\n", name, fake.word_count, words);
+		ret = -1;
+	}
+	for (uint8_t s = 0; s < strips && ret == 0; ++s)
+	{
+		for (unsigned int w = 0; w < words; ++w)
+		{
+			uint32_t want = (w == 0 || w == words - 1) ? 0 : test_words[s * chain_len + w - 1];
+			if (fake.words[s][w] != want)
+			{
+				fprintf(stderr, "%s: strip %u word %u is %08x instead of %08x\n", name, s, w, fake.words[s][w], want);
+				ret = -1;
+				break;
+			}
+		}
+	}
+
+	board_cleanup(&board);
+	gpio_uninit();
+
+	return ret;
+}
+
+// One SET_VALUES per clock edge on the multi-line handle, against a write per pin and edge
+static int cmd_gpio()
+{
+	unsigned long lines, per_pin;
+	if (gpio_run("lines", 0, &lines) < 0 || gpio_run("per_pin", 1, &per_pin) < 0)
+		return 1;
+
+	// Four words per strip, two strips sharing the clock
+	unsigned long bits = 4 * 32;
+	printf("# path ioctls_per_frame ioctls_per_bit\n");
+	printf("lines %lu %.2f\n", lines, (double)lines / bits);
+	printf("per_pin %lu %.2f\n", per_pin, (double)per_pin / bits);
+
+	if (lines != bits * 2)
+	{
+		fprintf(stderr, "The multi-line path took %lu ioctls instead of %lu\n", lines, bits * 2);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Two frames on a chain of three; the second is one pixel, repeated down the chain
+static const uint8_t spi_stream[] = {
+	0x00, 0x00, 0x00, 0x00,
+	0xFC, 0x00, 0x00, 0xFF,
+	0xE7, 0x40, 0x80, 0x00,
+	0xFF, 0x03, 0x02, 0x01,
+	0x00, 0x00, 0x00, 0x00,
+
+	0x00, 0x00, 0x00, 0x00,
+	0xC0, 0xFF, 0xFF, 0xFF,
+	0xC0, 0xFF, 0xFF, 0xFF,
+	0xC0, 0xFF, 0xFF, 0xFF,
+	0x00, 0x00, 0x00, 0x00,
+};
+
+// Compares what a P9813 chain on hardware SPI gets sent with a hand-checked bitstream
+static int cmd_p9813_spi()
+{
+	char path[] = "/tmp/boardtest.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		perror("Failed to create the fake spidev");
+		return 1;
+	}
+	fake_spi.path = path;
+
+	int ret = 0;
+	board_t board;
+	memset(&board, 0, sizeof(board));
+	if (board_init_p9813_spi(&board, 0, 0, 1000000, 3) < 0)
+	{
+		fprintf(stderr, "Failed to set up the fake spidev\n");
+		ret = 1;
+	}
+	else if (board_write_frame(&board, test_pixels, 3) < 0 || board_write_frame(&board, &test_pixels[3], 1) < 0)
+	{
+		fprintf(stderr, "Frame write failed\n");
+		ret = 1;
+	}
+	board_cleanup(&board);
+
+	uint8_t got[2 * sizeof(spi_stream)];
+	ssize_t len = ret == 0 ? pread(fd, got, sizeof(got), 0) : 0;
+	close(fd);
+	unlink(path);
+	if (ret != 0)
+		return ret;
+
+	printf("# messages bytes\n");
+	printf("%lu %zd\n", fake_spi.messages, len);
+
+	if (fake_spi.messages != 2)
+	{
+		fprintf(stderr, "%lu transfers instead of one per frame\n", fake_spi.messages);
+		return 1;
+	}
+	if (len != (ssize_t)sizeof(spi_stream))
+	{
+		fprintf(stderr, "%zd bytes sent instead of %zu\n", len, sizeof(spi_stream));
+		return 1;
+	}
+	for (size_t i = 0; i < sizeof(spi_stream); ++i)
+	{
+		if (got[i] != spi_stream[i])
+		{
+			fprintf(stderr, "Byte %zu is %02x instead of %02x\n", i, got[i], spi_stream[i]);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+#define MEM_CLOCK 17
+#define MEM_STRIPS 2
+static const uint8_t mem_data_pins[MEM_STRIPS] = { 4, 40 };
+
+// Shifts a frame through the BCM2835 register layout, and checks every function select and every store
+static int cmd_gpiomem()
+{
+	const gpio_regmap_t* map = &gpio_regmap_bcm2835;
+
+	char path[] = "/tmp/boardtest.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		perror("Failed to create the fake register block");
+		return 1;
+	}
+
+	// Every pin starts in alternate function 3, so stray function select bits show up
+	uint32_t fsel[6];
+	for (int i = 0; i < 6; ++i)
+		fsel[i] = 0x3FFFFFFF;
+	int ret = ftruncate(fd, map->size) < 0 || pwrite(fd, fsel, sizeof(fsel), map->fsel) != sizeof(fsel);
+
+	board_t board;
+	memset(&board, 0, sizeof(board));
+	if (ret == 0 && (gpio_init_mem(path, map) < 0 || board_init_p9813(&board, MEM_CLOCK, mem_data_pins, MEM_STRIPS, 1, GPIO_DEFAULT_CLOCK_HZ) < 0))
+		ret = 1;
+	if (ret != 0)
+	{
+		fprintf(stderr, "Failed to set up the fake register block\n");
+		unlink(path);
+		return 1;
+	}
+
+	void* regs = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	unlink(path);
+	if (regs == MAP_FAILED)
+	{
+		perror("Failed to map the fake register block");
+		return 1;
+	}
+
+	volatile uint32_t* reg = regs;
+	for (int i = 0; i < 6; ++i)
+	{
+		uint32_t want = 0x3FFFFFFF;
+		int pins[] = { MEM_CLOCK, mem_data_pins[0], mem_data_pins[1] };
+		for (int p = 0; p < 3; ++p)
+			if (pins[p] / 10 == i)
+				want = (want & ~(7U << (pins[p] % 10 * 3))) | (1U << (pins[p] % 10 * 3));
+
+		if (reg[map->fsel / 4 + i] != want)
+		{
+			fprintf(stderr, "Function select %d is %08x instead of %08x\n", i, reg[map->fsel / 4 + i], want);
+			ret = 1;
+		}
+	}
+	if (gpio_get_timing()->spin_ns == 0)
+	{
+		fprintf(stderr, "Clock edges are not held, so the writes can't be told apart\n");
+		ret = 1;
+	}
+
+	// Calibration already left its pulses behind
+	memset(&fake_mem, 0, sizeof(fake_mem));
+	fake_mem.map = map;
+	reg[map->set / 4] = reg[map->set / 4 + 1] = reg[map->clr / 4] = reg[map->clr / 4 + 1] = 0;
+	fake_mem.regs = reg;
+
+	if (ret == 0 && board_write_frame(&board, test_pixels, MEM_STRIPS) < 0)
+	{
+		fprintf(stderr, "Frame write failed\n");
+		ret = 1;
+	}
+	fake_mem_sample();
+	fake_mem.regs = NULL;
+
+	board_cleanup(&board);
+	gpio_uninit();
+	munmap(regs, map->size);
+	if (ret != 0)
+		return ret;
+
+	// Start frame, one pixel and end frame per strip, two stores per bit
+	unsigned int bits = 3 * 32;
+	printf("# writes bits\n");
+	printf("%u %u\n", fake_mem.count, bits);
+	if (fake_mem.count != bits * 2)
+	{
+		fprintf(stderr, "%u register writes instead of %u\n", fake_mem.count, bits * 2);
+		return 1;
+	}
+
+	for (unsigned int bit = 0; bit < bits; ++bit)
+	{
+		unsigned int word = bit / 32;
+		struct fake_mem_event_t want[2];
+		memset(want, 0, sizeof(want));
+
+		// Data changes together with the falling clock edge, then the clock rises on its own
+		want[0].clr[0] = 1U << MEM_CLOCK;
+		for (int s = 0; s < MEM_STRIPS; ++s)
+		{
+			uint32_t data = (word == 1 ? test_words[s] : 0) >> (31 - bit % 32) & 1;
+			uint8_t pin = mem_data_pins[s];
+			if (data)
+				want[0].set[pin / 32] |= 1U << (pin % 32);
+			else
+				want[0].clr[pin / 32] |= 1U << (pin % 32);
+		}
+		want[1].set[0] = 1U << MEM_CLOCK;
+
+		for (int e = 0; e < 2; ++e)
+		{
+			const struct fake_mem_event_t* got = &fake_mem.events[bit * 2 + e];
+			if (memcmp(got, &want[e], sizeof(want[e])) != 0)
+			{
+				fprintf(stderr, "Bit %u edge %d stored set %08x %08x clr %08x %08x instead of set %08x %08x clr %08x %08x\n",
+					bit, e, got->set[0], got->set[1], got->clr[0], got->clr[1],
+					want[e].set[0], want[e].set[1], want[e].clr[0], want[e].clr[1]);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("Usage: %s COMMAND\n\n"
+			"Commands:\n"
+			"  gpio       Shift a P9813 frame out over a fake gpiochip, check the bitstream and count the ioctls\n"
+			"  p9813-spi  Send P9813 frames to a fake spidev and compare the bytes with the expected stream\n"
+			"  gpiomem    Shift a P9813 frame through a file standing in for the BCM2835 registers, check every store\n",
+			argv[0]);
+		return 2;
+	}
+
+	if (strcmp(argv[1], "gpio") == 0)
+		return cmd_gpio();
+	else if (strcmp(argv[1], "p9813-spi") == 0)
+		return cmd_p9813_spi();
+	else if (strcmp(argv[1], "gpiomem") == 0)
+		return cmd_gpiomem();
+
+	fprintf(stderr, "Unknown command %s\n", argv[1]);
+	return 2;
+}
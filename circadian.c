@@ -0,0 +1,155 @@
+#include "circadian.h"
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+// Dim and warm at night, cool daylight around noon
+const circadian_point_t circadian_curve[CIRCADIAN_POINTS] = {
+	{ circadian_sunrise, -5400, 2000, 0.2f },
+	{ circadian_sunrise, 0, 2700, 0.6f },
+	{ circadian_sunrise, 7200, 5000, 1.f },
+	{ circadian_noon, 0, 6500, 1.f },
+	{ circadian_sunset, -7200, 5000, 1.f },
+	{ circadian_sunset, 0, 2700, 0.7f },
+	{ circadian_sunset, 7200, 2200, 0.4f },
+	{ circadian_sunset, 14400, 2000, 0.2f },
+};
+
+#define DEG (M_PI / 180.0)
+// Julian date of the unix epoch, and of J2000.0
+#define JD_UNIX 2440587.5
+#define JD_2000 2451545.0
+
+void circadian_init(circadian_t* circadian)
+{
+	memset(circadian, 0, sizeof(circadian_t));
+	circadian->day = INT64_MIN;
+}
+
+void circadian_set_location(circadian_t* circadian, float lat, float lon)
+{
+	circadian->lat = lat;
+	circadian->lon = lon;
+	circadian->located = 1;
+	circadian->day = INT64_MIN;
+}
+
+static int64_t circadian_unix(double jd)
+{
+	return (int64_t)llround((jd - JD_UNIX) * 86400.0);
+}
+
+// Sunrise equation, good to about a minute away from the poles
+static void circadian_sun(circadian_t* circadian, int64_t day)
+{
+	double jstar = day - circadian->lon / 360.0;
+	double m = fmod(357.5291 + 0.98560028 * jstar, 360.0);
+	double c = 1.9148 * sin(m * DEG) + 0.02 * sin(2 * m * DEG) + 0.0003 * sin(3 * m * DEG);
+	double l = fmod(m + c + 180.0 + 102.9372, 360.0);
+	double transit = JD_2000 + jstar + 0.0053 * sin(m * DEG) - 0.0069 * sin(2 * l * DEG);
+
+	double decl = asin(sin(l * DEG) * sin(23.4397 * DEG));
+	double cosw = (sin(-0.833 * DEG) - sin(circadian->lat * DEG) * sin(decl)) / (cos(circadian->lat * DEG) * cos(decl));
+
+	// Midnight sun and polar night leave the sun up or down all day
+	double w = 0;
+	if (cosw <= -1)
+		w = 180.0;
+	else if (cosw < 1)
+		w = acos(cosw) / DEG;
+
+	circadian->sunrise = circadian_unix(transit - w / 360.0);
+	circadian->noon = circadian_unix(transit);
+	circadian->sunset = circadian_unix(transit + w / 360.0);
+}
+
+static int64_t circadian_local(const struct tm* day, int hour)
+{
+	struct tm tm = *day;
+	tm.tm_hour = hour;
+	tm.tm_min = 0;
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+// Works out the day now falls in, and only resolves the curve again when it is a new one
+static void circadian_resolve(circadian_t* circadian, int64_t now)
+{
+	int64_t day;
+	struct tm local;
+	if (circadian->located)
+	{
+		// Counted in local solar days since J2000, so the day turns over around local solar midnight
+		double jd = now / 86400.0 + JD_UNIX;
+		day = llround(jd - JD_2000 + circadian->lon / 360.0);
+	}
+	else
+	{
+		time_t t = now;
+		localtime_r(&t, &local);
+		day = (int64_t)local.tm_year * 366 + local.tm_yday;
+	}
+
+	if (day == circadian->day)
+		return;
+
+	if (circadian->located)
+		circadian_sun(circadian, day);
+	else
+	{
+		circadian->sunrise = circadian_local(&local, 7);
+		circadian->noon = circadian_local(&local, 13);
+		circadian->sunset = circadian_local(&local, 19);
+	}
+
+	// Short days squeeze the points together, they never swap order
+	for (int i = 0; i < CIRCADIAN_POINTS; ++i)
+	{
+		const circadian_point_t* point = &circadian_curve[i];
+		int64_t base = point->event == circadian_sunrise ? circadian->sunrise
+			: (point->event == circadian_noon ? circadian->noon : circadian->sunset);
+
+		circadian->at[i] = base + point->offset_s;
+		if (i > 0 && circadian->at[i] < circadian->at[i - 1])
+			circadian->at[i] = circadian->at[i - 1];
+	}
+
+	circadian->day = day;
+	circadian->segment = 0;
+}
+
+void circadian_eval(circadian_t* circadian, int64_t now, temp_t* out)
+{
+	circadian_resolve(circadian, now);
+
+	const circadian_point_t* first = &circadian_curve[0];
+	const circadian_point_t* last = &circadian_curve[CIRCADIAN_POINTS - 1];
+	if (now <= circadian->at[0])
+	{
+		out->k = first->k;
+		out->v = first->v;
+		return;
+	}
+	if (now >= circadian->at[CIRCADIAN_POINTS - 1])
+	{
+		out->k = last->k;
+		out->v = last->v;
+		return;
+	}
+
+	if (now < circadian->at[circadian->segment])
+		circadian->segment = 0;
+	while (circadian->segment + 2 < CIRCADIAN_POINTS && now >= circadian->at[circadian->segment + 1])
+		circadian->segment++;
+
+	int i = circadian->segment;
+	const circadian_point_t* a = &circadian_curve[i];
+	const circadian_point_t* b = &circadian_curve[i + 1];
+	int64_t span = circadian->at[i + 1] - circadian->at[i];
+	float t = span > 0 ? (float)(now - circadian->at[i]) / span : 1.f;
+
+	out->k = a->k + (int)((b->k - a->k) * t);
+	out->v = a->v + (b->v - a->v) * t;
+}
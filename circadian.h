@@ -0,0 +1,50 @@
+#ifndef _CIRCADIAN_H
+#define _CIRCADIAN_H
+
+#include <stdint.h>
+#include "color.h"
+
+// Where a curve point sits, relative to one of the sun events of the day
+enum circadian_event_t
+{
+	circadian_sunrise = 0,
+	circadian_noon,
+	circadian_sunset
+};
+
+struct _circadian_point_t
+{
+	int event;
+	int32_t offset_s;
+
+	uint16_t k;
+	float v;
+};
+typedef struct _circadian_point_t circadian_point_t;
+
+#define CIRCADIAN_POINTS 8
+
+struct _circadian_t
+{
+	float lat, lon;
+	// Without a location the sun rises at 07:00 and sets at 19:00 local time
+	int located;
+
+	// Cached for the day the key names, resolved to wall clock seconds
+	int64_t day;
+	int64_t sunrise, noon, sunset;
+	int64_t at[CIRCADIAN_POINTS];
+	// Point the last evaluation fell after, only moves forward during a day
+	int segment;
+};
+typedef struct _circadian_t circadian_t;
+
+extern const circadian_point_t circadian_curve[CIRCADIAN_POINTS];
+
+void circadian_init(circadian_t*);
+void circadian_set_location(circadian_t*, float lat, float lon);
+
+// Temperature and brightness the curve gives at the wall clock second
+void circadian_eval(circadian_t*, int64_t now, temp_t* out);
+
+#endif
@@ -1,51 +1,22 @@
 #include "color.h"
+#include "temp_lut.h"
 
-#include <math.h>
+#include <stdint.h>
 
 #define CLAMP(a, min, max) (a < min ? min : (a > max ? max : a))
 
 int temperature2rgb(const temp_t *temp, rgb_t* rgb)
 {
-	int temperature = CLAMP(temp->k, 1000, 40000);
+	unsigned int temperature = CLAMP(temp->k, TEMP_LUT_MIN, TEMP_LUT_MAX);
+	const rgb_t* entry = &temp_lut[(temperature - TEMP_LUT_MIN) / TEMP_LUT_STEP];
 
-	float calc;
-	unsigned short frac = temperature / 100;
-	if (frac <= 66)
-		rgb->r = 255;
-	else
-	{
-		calc = frac - 60;
-		calc = 329.698727446f * fmod(calc, -0.1332047592f);
-		rgb->r = CLAMP(calc, 0, 255);
-	}
+	// Brightness as 16.16 fixed point, so 1.0 keeps the table value exactly
+	float v = CLAMP(temp->v, 0.f, 1.f);
+	uint32_t scale = (uint32_t)(v * 65536.f + 0.5f);
 
-	if (frac <= 66)
-	{
-		calc = frac;
-		calc = 99.4708025861f * log(calc) - 161.1195681661f;
-		rgb->g = CLAMP(calc, 0, 255);
-	}
-	else
-	{
-		calc = frac - 60;
-		calc = 288.1221695283f * fmod(calc, -0.0755148492f);
-		rgb->g = CLAMP(calc, 0, 255);
-	}
-
-	if (frac >= 66)
-		rgb->b = 255;
-	else if (frac <= 19)
-		rgb->b = 0;
-	else
-	{
-		calc = frac - 10;
-		calc = 138.5177312231f * log(calc) - 305.0447927307f;
-		rgb->b = CLAMP(calc, 0, 255);
-	}
-
-	rgb->r *= temp->v;
-	rgb->g *= temp->v;
-	rgb->b *= temp->v;
+	rgb->r = (entry->r * scale) >> 16;
+	rgb->g = (entry->g * scale) >> 16;
+	rgb->b = (entry->b * scale) >> 16;
 
 	return 0;
 }
@@ -134,3 +105,101 @@ int rgb2hsv(const rgb_t* rgb, hsv_t* hsv)
 
 	return 0;
 }
+
+int temperature2rgb16(const temp_t *temp, rgb16_t* rgb)
+{
+	unsigned int temperature = CLAMP(temp->k, TEMP_LUT_MIN, TEMP_LUT_MAX);
+	const rgb_t* entry = &temp_lut[(temperature - TEMP_LUT_MIN) / TEMP_LUT_STEP];
+
+	float v = CLAMP(temp->v, 0.f, 1.f);
+	uint32_t scale = (uint32_t)(v * 65536.f + 0.5f);
+
+	rgb->r = (COLOR_8TO16(entry->r) * scale) >> 16;
+	rgb->g = (COLOR_8TO16(entry->g) * scale) >> 16;
+	rgb->b = (COLOR_8TO16(entry->b) * scale) >> 16;
+
+	return 0;
+}
+
+int hsv2rgb16(const hsv16_t* hsv, rgb16_t* rgb)
+{
+	if (hsv->h > 360)
+		return -1;
+
+	if (hsv->s == 0)
+	{
+		rgb->r = hsv->v;
+		rgb->g = hsv->v;
+		rgb->b = hsv->v;
+		return 0;
+	}
+
+	// Every product fits 32 bits, 65535 * 65535 < 2^32
+	uint32_t region = (hsv->h / 60) % 6;
+	uint32_t remainder = (hsv->h % 60) * 65535U / 60;
+
+	uint16_t p = (uint32_t)hsv->v * (65535 - hsv->s) / 65535;
+	uint16_t q = (uint32_t)hsv->v * (65535 - (uint32_t)hsv->s * remainder / 65535) / 65535;
+	uint16_t t = (uint32_t)hsv->v * (65535 - (uint32_t)hsv->s * (65535 - remainder) / 65535) / 65535;
+
+	switch (region)
+	{
+		case 0:
+			rgb->r = hsv->v; rgb->g = t; rgb->b = p;
+			break;
+
+		case 1:
+			rgb->r = q; rgb->g = hsv->v; rgb->b = p;
+			break;
+
+		case 2:
+			rgb->r = p; rgb->g = hsv->v; rgb->b = t;
+			break;
+
+		case 3:
+			rgb->r = p; rgb->g = q; rgb->b = hsv->v;
+			break;
+
+		case 4:
+			rgb->r = t; rgb->g = p; rgb->b = hsv->v;
+			break;
+
+		default:
+			rgb->r = hsv->v; rgb->g = p; rgb->b = q;
+			break;
+	}
+
+	return 0;
+}
+
+int rgb2hsv16(const rgb16_t* rgb, hsv16_t* hsv)
+{
+	uint16_t rgbMin, rgbMax;
+
+	rgbMin = rgb->r < rgb->g ? (rgb->r < rgb->b ? rgb->r : rgb->b) : (rgb->g < rgb->b ? rgb->g : rgb->b);
+	rgbMax = rgb->r > rgb->g ? (rgb->r > rgb->b ? rgb->r : rgb->b) : (rgb->g > rgb->b ? rgb->g : rgb->b);
+
+	hsv->v = rgbMax;
+	if (rgbMax == 0 || rgbMax == rgbMin)
+	{
+		hsv->h = 0;
+		hsv->s = 0;
+		return 0;
+	}
+
+	int32_t delta = rgbMax - rgbMin;
+	hsv->s = (uint32_t)delta * 65535 / rgbMax;
+
+	// Unlike rgb2hsv() the hue comes out in degrees, matching hsv2rgb16()
+	int32_t h;
+	if (rgbMax == rgb->r)
+		h = 60 * (rgb->g - rgb->b) / delta;
+	else if (rgbMax == rgb->g)
+		h = 120 + 60 * (rgb->b - rgb->r) / delta;
+	else
+		h = 240 + 60 * (rgb->r - rgb->g) / delta;
+
+	hsv->h = h < 0 ? h + 360 : h;
+
+	return 0;
+}
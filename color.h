@@ -1,6 +1,9 @@
 #ifndef _LIGHT_H
 #define _LIGHT_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 struct _hsv_t
 {
 	unsigned short h;
@@ -21,8 +24,48 @@ struct _temp_t
 };
 typedef struct _temp_t temp_t;
 
+// 16 bits per channel, only quantised to the board depth when written out
+struct _rgb16_t
+{
+	uint16_t r, g, b;
+};
+typedef struct _rgb16_t rgb16_t;
+
+// Hue in degrees like hsv_t, saturation and value with 16 bits
+struct _hsv16_t
+{
+	unsigned short h;
+	uint16_t s, v;
+};
+typedef struct _hsv16_t hsv16_t;
+
+#define COLOR_8TO16(x) ((uint16_t)((x) * 257U))
+#define COLOR_16TO8(x) ((uint8_t)(((x) + 128U) / 257U))
+
 int temperature2rgb(const temp_t*, rgb_t*);
 int hsv2rgb(const hsv_t*, rgb_t*);
 int rgb2hsv(const rgb_t*, hsv_t*);
 
+int temperature2rgb16(const temp_t*, rgb16_t*);
+int hsv2rgb16(const hsv16_t*, rgb16_t*);
+int rgb2hsv16(const rgb16_t*, hsv16_t*);
+
+// Convert whole arrays at once, results are bit-identical to the calls above.
+// hsv2rgb_batch() skips and reports out of range hues the same way hsv2rgb() does.
+int hsv2rgb_batch(const hsv_t*, rgb_t*, size_t);
+int rgb2hsv_batch(const rgb_t*, hsv_t*, size_t);
+// 3x3 colour correction, row-major with one row per output channel. Coefficients are
+// fixed point with COLOR_CCM_ONE as unity and must stay within +-COLOR_CCM_MAX.
+#define COLOR_CCM_SHIFT 10
+#define COLOR_CCM_ONE (1 << COLOR_CCM_SHIFT)
+#define COLOR_CCM_MAX (4 * COLOR_CCM_ONE)
+int rgb16_ccm_batch(const int32_t* matrix, const rgb16_t* in, rgb16_t* out, size_t);
+// Blends over onto under, alpha is fixed point with COLOR_ALPHA_ONE as fully opaque.
+// out may be either of the inputs.
+#define COLOR_ALPHA_SHIFT 15
+#define COLOR_ALPHA_ONE (1 << COLOR_ALPHA_SHIFT)
+int rgb16_blend_batch(const rgb16_t* under, const rgb16_t* over, uint16_t alpha, rgb16_t* out, size_t);
+// Name of the compiled-in kernel; "avx2", "sse2", "neon" or "scalar"
+const char* color_batch_impl();
+
 #endif
@@ -0,0 +1,440 @@
+#include "color.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Batch kernels work on blocks of COLOR_BLOCK pixels, staged from the packed
+// arrays into structure-of-arrays lanes. Every lane operation is exact in the
+// integer width it runs in, so the results match hsv2rgb()/rgb2hsv() bit for
+// bit, including the unsigned wraparound of a negative hue.
+#define COLOR_BLOCK 16
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define COLOR_SIMD "avx2"
+
+typedef __m256i vu16_t;
+#define VU16_LANES 16
+#define vu16_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define vu16_store(p, a) _mm256_storeu_si256((__m256i*)(p), a)
+#define vu16_set1(x) _mm256_set1_epi16(x)
+#define vu16_add(a, b) _mm256_add_epi16(a, b)
+#define vu16_sub(a, b) _mm256_sub_epi16(a, b)
+#define vu16_mul(a, b) _mm256_mullo_epi16(a, b)
+#define vu16_shr8(a) _mm256_srli_epi16(a, 8)
+#define vu16_eq(a, b) _mm256_cmpeq_epi16(a, b)
+#define vu16_gt(a, b) _mm256_cmpgt_epi16(a, b)
+#define vu16_or(a, b) _mm256_or_si256(a, b)
+#define vu16_sel(m, a, b) _mm256_blendv_epi8(b, a, m)
+
+typedef __m256i vi32_t;
+#define VI32_LANES 8
+#define vi32_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define vi32_store(p, a) _mm256_storeu_si256((__m256i*)(p), a)
+#define vi32_set1(x) _mm256_set1_epi32(x)
+#define vi32_add(a, b) _mm256_add_epi32(a, b)
+#define vi32_sub(a, b) _mm256_sub_epi32(a, b)
+#define vi32_mul(a, b) _mm256_mullo_epi32(a, b)
+#define vi32_shr(a, n) _mm256_srai_epi32(a, n)
+#define vi32_eq(a, b) _mm256_cmpeq_epi32(a, b)
+#define vi32_or(a, b) _mm256_or_si256(a, b)
+#define vi32_sel(m, a, b) _mm256_blendv_epi8(b, a, m)
+#define vi32_min(a, b) _mm256_min_epi32(a, b)
+#define vi32_max(a, b) _mm256_max_epi32(a, b)
+#define vi32_div(a, b) _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(a), _mm256_cvtepi32_ps(b)))
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define COLOR_SIMD "sse2"
+
+typedef __m128i vu16_t;
+#define VU16_LANES 8
+#define vu16_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define vu16_store(p, a) _mm_storeu_si128((__m128i*)(p), a)
+#define vu16_set1(x) _mm_set1_epi16(x)
+#define vu16_add(a, b) _mm_add_epi16(a, b)
+#define vu16_sub(a, b) _mm_sub_epi16(a, b)
+#define vu16_mul(a, b) _mm_mullo_epi16(a, b)
+#define vu16_shr8(a) _mm_srli_epi16(a, 8)
+#define vu16_eq(a, b) _mm_cmpeq_epi16(a, b)
+#define vu16_gt(a, b) _mm_cmpgt_epi16(a, b)
+#define vu16_or(a, b) _mm_or_si128(a, b)
+#define vu16_sel(m, a, b) _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b))
+
+typedef __m128i vi32_t;
+#define VI32_LANES 4
+#define vi32_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define vi32_store(p, a) _mm_storeu_si128((__m128i*)(p), a)
+#define vi32_set1(x) _mm_set1_epi32(x)
+#define vi32_add(a, b) _mm_add_epi32(a, b)
+#define vi32_sub(a, b) _mm_sub_epi32(a, b)
+#define vi32_eq(a, b) _mm_cmpeq_epi32(a, b)
+#define vi32_or(a, b) _mm_or_si128(a, b)
+#define vi32_sel(m, a, b) _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b))
+#define vi32_min(a, b) vi32_sel(_mm_cmplt_epi32(a, b), a, b)
+#define vi32_max(a, b) vi32_sel(_mm_cmpgt_epi32(a, b), a, b)
+#define vi32_mul(a, b) sse2_mullo_epi32(a, b)
+#define vi32_shr(a, n) _mm_srai_epi32(a, n)
+#define vi32_div(a, b) _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(a), _mm_cvtepi32_ps(b)))
+
+// SSE2 has no 32-bit low multiply, build it from the even and odd 64-bit products
+static inline __m128i sse2_mullo_epi32(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define COLOR_SIMD "neon"
+
+typedef uint16x8_t vu16_t;
+#define VU16_LANES 8
+#define vu16_load(p) vld1q_u16(p)
+#define vu16_store(p, a) vst1q_u16(p, a)
+#define vu16_set1(x) vdupq_n_u16(x)
+#define vu16_add(a, b) vaddq_u16(a, b)
+#define vu16_sub(a, b) vsubq_u16(a, b)
+#define vu16_mul(a, b) vmulq_u16(a, b)
+#define vu16_shr8(a) vshrq_n_u16(a, 8)
+#define vu16_eq(a, b) vceqq_u16(a, b)
+#define vu16_gt(a, b) vcgtq_u16(a, b)
+#define vu16_or(a, b) vorrq_u16(a, b)
+#define vu16_sel(m, a, b) vbslq_u16(m, a, b)
+
+typedef int32x4_t vi32_t;
+#define VI32_LANES 4
+#define vi32_load(p) vld1q_s32(p)
+#define vi32_store(p, a) vst1q_s32(p, a)
+#define vi32_set1(x) vdupq_n_s32(x)
+#define vi32_add(a, b) vaddq_s32(a, b)
+#define vi32_sub(a, b) vsubq_s32(a, b)
+#define vi32_mul(a, b) vmulq_s32(a, b)
+#define vi32_eq(a, b) vreinterpretq_s32_u32(vceqq_s32(a, b))
+#define vi32_or(a, b) vorrq_s32(a, b)
+#define vi32_sel(m, a, b) vbslq_s32(vreinterpretq_u32_s32(m), a, b)
+#define vi32_min(a, b) vminq_s32(a, b)
+#define vi32_max(a, b) vmaxq_s32(a, b)
+#define vi32_shr(a, n) vshrq_n_s32(a, n)
+// 32-bit NEON has no vector divide, so rgb2hsv stays scalar there
+#if defined(__aarch64__)
+#define vi32_div(a, b) vcvtq_s32_f32(vdivq_f32(vcvtq_f32_s32(a), vcvtq_f32_s32(b)))
+#endif
+
+#endif
+
+const char* color_batch_impl()
+{
+#ifdef COLOR_SIMD
+	return COLOR_SIMD;
+#else
+	return "scalar";
+#endif
+}
+
+#ifdef VU16_LANES
+static void hsv2rgb_block(const uint16_t* h, const uint16_t* s, const uint16_t* v,
+                          uint16_t* r, uint16_t* g, uint16_t* b)
+{
+	for (int i = 0; i < COLOR_BLOCK; i += VU16_LANES)
+	{
+		vu16_t vh = vu16_load(h + i);
+		vu16_t vs = vu16_load(s + i);
+		vu16_t vv = vu16_load(v + i);
+		vu16_t c255 = vu16_set1(255);
+
+		// Hue sextant by counting thresholds, 360 lands in region 6 == 0
+		vu16_t region = vu16_set1(0);
+		for (int k = 1; k <= 6; ++k)
+			region = vu16_sub(region, vu16_gt(vh, vu16_set1(k * 60 - 1)));
+		vu16_t remainder = vu16_mul(vu16_sub(vh, vu16_mul(region, vu16_set1(60))), vu16_set1(4));
+
+		// All products stay below 65536, so 16-bit lanes are exact
+		vu16_t p = vu16_shr8(vu16_mul(vv, vu16_sub(c255, vs)));
+		vu16_t q = vu16_shr8(vu16_mul(vv, vu16_sub(c255, vu16_shr8(vu16_mul(vs, remainder)))));
+		vu16_t t = vu16_shr8(vu16_mul(vv, vu16_sub(c255, vu16_shr8(vu16_mul(vs, vu16_sub(c255, remainder))))));
+
+		vu16_t r0 = vu16_or(vu16_eq(region, vu16_set1(0)), vu16_eq(region, vu16_set1(6)));
+		vu16_t r1 = vu16_eq(region, vu16_set1(1));
+		vu16_t r2 = vu16_eq(region, vu16_set1(2));
+		vu16_t r3 = vu16_eq(region, vu16_set1(3));
+		vu16_t r4 = vu16_eq(region, vu16_set1(4));
+
+		vu16_t vr = vu16_sel(r0, vv, vu16_sel(r1, q, vu16_sel(r2, p, vu16_sel(r3, p, vu16_sel(r4, t, vv)))));
+		vu16_t vg = vu16_sel(r0, t, vu16_sel(r1, vv, vu16_sel(r2, vv, vu16_sel(r3, q, p))));
+		vu16_t vb = vu16_sel(r0, p, vu16_sel(r1, p, vu16_sel(r2, t, vu16_sel(r3, vv, vu16_sel(r4, vv, q)))));
+
+		vu16_t grey = vu16_eq(vs, vu16_set1(0));
+		vu16_store(r + i, vu16_sel(grey, vv, vr));
+		vu16_store(g + i, vu16_sel(grey, vv, vg));
+		vu16_store(b + i, vu16_sel(grey, vv, vb));
+	}
+}
+#endif
+
+int hsv2rgb_batch(const hsv_t* hsv, rgb_t* rgb, size_t count)
+{
+	int ret = 0;
+
+#ifdef VU16_LANES
+	uint16_t h[COLOR_BLOCK], s[COLOR_BLOCK], v[COLOR_BLOCK];
+	uint16_t r[COLOR_BLOCK], g[COLOR_BLOCK], b[COLOR_BLOCK];
+
+	while (count > 0)
+	{
+		size_t len = count < COLOR_BLOCK ? count : COLOR_BLOCK;
+
+		memset(h, 0, sizeof(h));
+		memset(s, 0, sizeof(s));
+		memset(v, 0, sizeof(v));
+		for (size_t i = 0; i < len; ++i)
+		{
+			h[i] = hsv[i].h;
+			s[i] = hsv[i].s;
+			v[i] = hsv[i].v;
+		}
+
+		hsv2rgb_block(h, s, v, r, g, b);
+
+		for (size_t i = 0; i < len; ++i)
+		{
+			// Out of range hues leave the output untouched, like hsv2rgb()
+			if (h[i] > 360)
+			{
+				ret = -1;
+				continue;
+			}
+
+			rgb[i].r = r[i];
+			rgb[i].g = g[i];
+			rgb[i].b = b[i];
+		}
+
+		hsv += len;
+		rgb += len;
+		count -= len;
+	}
+#else
+	for (size_t i = 0; i < count; ++i)
+		if (hsv2rgb(&hsv[i], &rgb[i]) < 0)
+			ret = -1;
+#endif
+
+	return ret;
+}
+
+#ifdef vi32_div
+static void rgb2hsv_block(const int32_t* r, const int32_t* g, const int32_t* b,
+                          int32_t* h, int32_t* s, int32_t* v)
+{
+	for (int i = 0; i < COLOR_BLOCK; i += VI32_LANES)
+	{
+		vi32_t vr = vi32_load(r + i);
+		vi32_t vg = vi32_load(g + i);
+		vi32_t vb = vi32_load(b + i);
+		vi32_t zero = vi32_set1(0);
+
+		vi32_t min = vi32_min(vr, vi32_min(vg, vb));
+		vi32_t max = vi32_max(vr, vi32_max(vg, vb));
+		vi32_t delta = vi32_sub(max, min);
+
+		// Grey lanes divide by one instead, their result is masked out below
+		vi32_t grey = vi32_or(vi32_eq(max, zero), vi32_eq(delta, zero));
+		vi32_t one = vi32_set1(1);
+		vi32_t dmax = vi32_sel(grey, one, max);
+		vi32_t ddelta = vi32_sel(grey, one, delta);
+
+		// Operands are at most 255 * 255, so float division truncates exactly
+		vi32_t vs = vi32_div(vi32_mul(vi32_set1(255), delta), dmax);
+
+		vi32_t isr = vi32_eq(max, vr);
+		vi32_t isg = vi32_eq(max, vg);
+		vi32_t diff = vi32_sel(isr, vi32_sub(vg, vb), vi32_sel(isg, vi32_sub(vb, vr), vi32_sub(vr, vg)));
+		vi32_t base = vi32_sel(isr, zero, vi32_sel(isg, vi32_set1(85), vi32_set1(171)));
+		vi32_t vh = vi32_add(base, vi32_div(vi32_mul(vi32_set1(43), diff), ddelta));
+
+		grey = vi32_or(grey, vi32_eq(vs, zero));
+		vi32_store(h + i, vi32_sel(grey, zero, vh));
+		vi32_store(s + i, vi32_sel(grey, zero, vs));
+		vi32_store(v + i, max);
+	}
+}
+#endif
+
+int rgb2hsv_batch(const rgb_t* rgb, hsv_t* hsv, size_t count)
+{
+#ifdef vi32_div
+	int32_t r[COLOR_BLOCK], g[COLOR_BLOCK], b[COLOR_BLOCK];
+	int32_t h[COLOR_BLOCK], s[COLOR_BLOCK], v[COLOR_BLOCK];
+
+	while (count > 0)
+	{
+		size_t len = count < COLOR_BLOCK ? count : COLOR_BLOCK;
+
+		memset(r, 0, sizeof(r));
+		memset(g, 0, sizeof(g));
+		memset(b, 0, sizeof(b));
+		for (size_t i = 0; i < len; ++i)
+		{
+			r[i] = rgb[i].r;
+			g[i] = rgb[i].g;
+			b[i] = rgb[i].b;
+		}
+
+		rgb2hsv_block(r, g, b, h, s, v);
+
+		for (size_t i = 0; i < len; ++i)
+		{
+			hsv[i].h = (uint16_t)h[i];
+			hsv[i].s = s[i];
+			hsv[i].v = v[i];
+		}
+
+		rgb += len;
+		hsv += len;
+		count -= len;
+	}
+#else
+	for (size_t i = 0; i < count; ++i)
+		rgb2hsv(&rgb[i], &hsv[i]);
+#endif
+
+	return 0;
+}
+
+#ifdef VI32_LANES
+static void rgb16_ccm_block(const int32_t* m, const int32_t* r, const int32_t* g, const int32_t* b,
+                            int32_t* outr, int32_t* outg, int32_t* outb)
+{
+	vi32_t round = vi32_set1(COLOR_CCM_ONE / 2);
+	vi32_t zero = vi32_set1(0);
+	vi32_t full = vi32_set1(65535);
+
+	for (int i = 0; i < COLOR_BLOCK; i += VI32_LANES)
+	{
+		vi32_t vr = vi32_load(r + i);
+		vi32_t vg = vi32_load(g + i);
+		vi32_t vb = vi32_load(b + i);
+		int32_t* out[3] = { outr, outg, outb };
+
+		for (int row = 0; row < 3; ++row)
+		{
+			vi32_t acc = vi32_add(vi32_mul(vr, vi32_set1(m[row * 3])), vi32_mul(vg, vi32_set1(m[row * 3 + 1])));
+			acc = vi32_add(vi32_add(acc, vi32_mul(vb, vi32_set1(m[row * 3 + 2]))), round);
+			acc = vi32_shr(acc, COLOR_CCM_SHIFT);
+			vi32_store(out[row] + i, vi32_min(vi32_max(acc, zero), full));
+		}
+	}
+}
+#else
+static int32_t ccm_clamp(int32_t v)
+{
+	return v < 0 ? 0 : (v > 65535 ? 65535 : v);
+}
+#endif
+
+int rgb16_ccm_batch(const int32_t* m, const rgb16_t* in, rgb16_t* out, size_t count)
+{
+#ifdef VI32_LANES
+	int32_t r[COLOR_BLOCK], g[COLOR_BLOCK], b[COLOR_BLOCK];
+	int32_t outr[COLOR_BLOCK], outg[COLOR_BLOCK], outb[COLOR_BLOCK];
+
+	while (count > 0)
+	{
+		size_t len = count < COLOR_BLOCK ? count : COLOR_BLOCK;
+
+		memset(r, 0, sizeof(r));
+		memset(g, 0, sizeof(g));
+		memset(b, 0, sizeof(b));
+		for (size_t i = 0; i < len; ++i)
+		{
+			r[i] = in[i].r;
+			g[i] = in[i].g;
+			b[i] = in[i].b;
+		}
+
+		rgb16_ccm_block(m, r, g, b, outr, outg, outb);
+
+		for (size_t i = 0; i < len; ++i)
+		{
+			out[i].r = outr[i];
+			out[i].g = outg[i];
+			out[i].b = outb[i];
+		}
+
+		in += len;
+		out += len;
+		count -= len;
+	}
+#else
+	for (size_t i = 0; i < count; ++i)
+	{
+		int32_t r = in[i].r, g = in[i].g, b = in[i].b;
+		out[i].r = ccm_clamp((m[0] * r + m[1] * g + m[2] * b + COLOR_CCM_ONE / 2) >> COLOR_CCM_SHIFT);
+		out[i].g = ccm_clamp((m[3] * r + m[4] * g + m[5] * b + COLOR_CCM_ONE / 2) >> COLOR_CCM_SHIFT);
+		out[i].b = ccm_clamp((m[6] * r + m[7] * g + m[8] * b + COLOR_CCM_ONE / 2) >> COLOR_CCM_SHIFT);
+	}
+#endif
+
+	return 0;
+}
+
+#ifdef VI32_LANES
+// Channels blend independently, so the packed frames are worked on as flat arrays
+static void rgb16_blend_block(const int32_t* under, const int32_t* over, int32_t alpha, int32_t* out)
+{
+	vi32_t va = vi32_set1(alpha);
+	vi32_t round = vi32_set1(COLOR_ALPHA_ONE / 2);
+
+	for (int i = 0; i < COLOR_BLOCK * 3; i += VI32_LANES)
+	{
+		vi32_t vu = vi32_load(under + i);
+		vi32_t diff = vi32_sub(vi32_load(over + i), vu);
+		vi32_store(out + i, vi32_add(vu, vi32_shr(vi32_add(vi32_mul(diff, va), round), COLOR_ALPHA_SHIFT)));
+	}
+}
+#endif
+
+int rgb16_blend_batch(const rgb16_t* under, const rgb16_t* over, uint16_t alpha, rgb16_t* out, size_t count)
+{
+	if (alpha > COLOR_ALPHA_ONE)
+		return -1;
+
+	const uint16_t* u = (const uint16_t*)under;
+	const uint16_t* o = (const uint16_t*)over;
+	uint16_t* d = (uint16_t*)out;
+	count *= 3;
+
+#ifdef VI32_LANES
+	int32_t bu[COLOR_BLOCK * 3], bo[COLOR_BLOCK * 3], bd[COLOR_BLOCK * 3];
+
+	while (count > 0)
+	{
+		size_t len = count < COLOR_BLOCK * 3 ? count : COLOR_BLOCK * 3;
+
+		memset(bu, 0, sizeof(bu));
+		memset(bo, 0, sizeof(bo));
+		for (size_t i = 0; i < len; ++i)
+		{
+			bu[i] = u[i];
+			bo[i] = o[i];
+		}
+
+		rgb16_blend_block(bu, bo, alpha, bd);
+
+		for (size_t i = 0; i < len; ++i)
+			d[i] = bd[i];
+
+		u += len;
+		o += len;
+		d += len;
+		count -= len;
+	}
+#else
+	for (size_t i = 0; i < count; ++i)
+		d[i] = u[i] + (((o[i] - u[i]) * (int32_t)alpha + COLOR_ALPHA_ONE / 2) >> COLOR_ALPHA_SHIFT);
+#endif
+
+	return 0;
+}
@@ -0,0 +1,660 @@
+#include "board.h"
+#include "color.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Largest batch the bench command runs
+#define BENCH_MAX 4096
+// Every measurement repeats the conversion for at least this long
+#define BENCH_MIN_NS 50000000ULL
+
+static hsv_t bench_hsv[BENCH_MAX];
+static rgb_t bench_rgb[BENCH_MAX];
+static hsv16_t bench_hsv16[BENCH_MAX];
+static rgb16_t bench_rgb16[BENCH_MAX];
+static rgb16_t bench_rgb16_out[BENCH_MAX];
+static temp_t bench_temp[BENCH_MAX];
+
+static volatile unsigned int bench_sink;
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void run_hsv2rgb(size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		hsv2rgb(&bench_hsv[i], &bench_rgb[i]);
+	bench_sink += bench_rgb[n - 1].r;
+}
+
+static void run_rgb2hsv(size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		rgb2hsv(&bench_rgb[i], &bench_hsv[i]);
+	bench_sink += bench_hsv[n - 1].h;
+}
+
+static void run_temperature2rgb(size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		temperature2rgb(&bench_temp[i], &bench_rgb[i]);
+	bench_sink += bench_rgb[n - 1].r;
+}
+
+static void run_hsv2rgb_batch(size_t n)
+{
+	hsv2rgb_batch(bench_hsv, bench_rgb, n);
+	bench_sink += bench_rgb[n - 1].r;
+}
+
+static void run_rgb2hsv_batch(size_t n)
+{
+	rgb2hsv_batch(bench_rgb, bench_hsv, n);
+	bench_sink += bench_hsv[n - 1].h;
+}
+
+static void run_hsv2rgb16(size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		hsv2rgb16(&bench_hsv16[i], &bench_rgb16[i]);
+	bench_sink += bench_rgb16[n - 1].r;
+}
+
+static void run_rgb2hsv16(size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		rgb2hsv16(&bench_rgb16[i], &bench_hsv16[i]);
+	bench_sink += bench_hsv16[n - 1].h;
+}
+
+static void run_temperature2rgb16(size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		temperature2rgb16(&bench_temp[i], &bench_rgb16[i]);
+	bench_sink += bench_rgb16[n - 1].r;
+}
+
+static void run_rgb16_blend_batch(size_t n)
+{
+	rgb16_blend_batch(bench_rgb16, bench_rgb16 + (BENCH_MAX - n), COLOR_ALPHA_ONE / 3, bench_rgb16_out, n);
+	bench_sink += bench_rgb16_out[n - 1].r;
+}
+
+// Frames only go as far as the quantised copy, so the kernels are timed without a bus
+static int null_write_frame(const board_t* board, const rgb_t* pixels, size_t n)
+{
+	(void)board;
+	(void)pixels;
+	(void)n;
+
+	return 0;
+}
+
+static const board_ops_t null_ops = {
+	.name = "null",
+	.caps = BOARD_CAP_PER_PIXEL,
+	.max_fps = 0,
+	.bit_depth = 8,
+
+	.write_frame = null_write_frame
+};
+
+static board_t bench_board, bench_board_dither;
+
+static void run_board_quantise(size_t n)
+{
+	board_write_frame16(&bench_board, bench_rgb16, n);
+	bench_sink += bench_board.quant[n - 1].r;
+}
+
+static void run_board_dither(size_t n)
+{
+	board_write_frame16(&bench_board_dither, bench_rgb16, n);
+	bench_sink += bench_board_dither.quant[n - 1].r;
+}
+
+static const struct
+{
+	const char* name;
+	void (*run)(size_t);
+} benches[] = {
+	{ "hsv2rgb", run_hsv2rgb },
+	{ "rgb2hsv", run_rgb2hsv },
+	{ "temperature2rgb", run_temperature2rgb },
+	{ "hsv2rgb_batch", run_hsv2rgb_batch },
+	{ "rgb2hsv_batch", run_rgb2hsv_batch },
+	{ "hsv2rgb16", run_hsv2rgb16 },
+	{ "rgb2hsv16", run_rgb2hsv16 },
+	{ "temperature2rgb16", run_temperature2rgb16 },
+	{ "rgb16_blend_batch", run_rgb16_blend_batch },
+	{ "board_quantise", run_board_quantise },
+	{ "board_dither", run_board_dither },
+};
+
+static void bench_fill()
+{
+	// Fixed LCG so every run converts the same colours
+	uint32_t seed = 1;
+	for (size_t i = 0; i < BENCH_MAX; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		bench_rgb[i].r = seed >> 24;
+		bench_rgb[i].g = seed >> 16;
+		bench_rgb[i].b = seed >> 8;
+		bench_rgb16[i].r = COLOR_8TO16(bench_rgb[i].r) ^ (seed & 0xff);
+		bench_rgb16[i].g = COLOR_8TO16(bench_rgb[i].g);
+		bench_rgb16[i].b = COLOR_8TO16(bench_rgb[i].b);
+		rgb2hsv16(&bench_rgb16[i], &bench_hsv16[i]);
+
+		bench_hsv[i].h = bench_hsv16[i].h;
+		bench_hsv[i].s = bench_hsv16[i].s >> 8;
+		bench_hsv[i].v = bench_hsv16[i].v >> 8;
+
+		bench_temp[i].k = 1000 + seed % 39001;
+		bench_temp[i].v = (seed >> 8 & 0xff) / 255.f;
+	}
+}
+
+static int bench_boards()
+{
+	board_t* boards[2] = { &bench_board, &bench_board_dither };
+	for (int i = 0; i < 2; ++i)
+	{
+		memset(boards[i], 0, sizeof(board_t));
+		boards[i]->ops = &null_ops;
+		boards[i]->pixels = BENCH_MAX;
+		if (board_start(boards[i]) < 0)
+			return -1;
+	}
+
+	return board_set_dither(&bench_board_dither, 1);
+}
+
+static uint16_t blend_scalar(uint16_t under, uint16_t over, uint16_t alpha)
+{
+	return under + (((over - under) * (int32_t)alpha + COLOR_ALPHA_ONE / 2) >> COLOR_ALPHA_SHIFT);
+}
+
+// A batch kernel is only worth timing while it still gives what the scalar calls give
+static int bench_verify(size_t n)
+{
+	static rgb_t rgb[BENCH_MAX], want_rgb[BENCH_MAX];
+	static hsv_t hsv[BENCH_MAX], want_hsv[BENCH_MAX];
+	static rgb16_t blend[BENCH_MAX];
+
+	// Out of range hues leave the output as it was, so both start from the same pixels
+	memcpy(rgb, bench_rgb, n * sizeof(rgb_t));
+	memcpy(want_rgb, bench_rgb, n * sizeof(rgb_t));
+	hsv2rgb_batch(bench_hsv, rgb, n);
+	for (size_t i = 0; i < n; ++i)
+		hsv2rgb(&bench_hsv[i], &want_rgb[i]);
+
+	rgb2hsv_batch(bench_rgb, hsv, n);
+	for (size_t i = 0; i < n; ++i)
+		rgb2hsv(&bench_rgb[i], &want_hsv[i]);
+
+	const rgb16_t* over = bench_rgb16 + (BENCH_MAX - n);
+	rgb16_blend_batch(bench_rgb16, over, COLOR_ALPHA_ONE / 3, blend, n);
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (rgb[i].r != want_rgb[i].r || rgb[i].g != want_rgb[i].g || rgb[i].b != want_rgb[i].b)
+		{
+			fprintf(stderr, "hsv2rgb_batch differs from hsv2rgb at pixel %zu of %zu\n", i, n);
+			return -1;
+		}
+		if (hsv[i].h != want_hsv[i].h || hsv[i].s != want_hsv[i].s || hsv[i].v != want_hsv[i].v)
+		{
+			fprintf(stderr, "rgb2hsv_batch differs from rgb2hsv at pixel %zu of %zu\n", i, n);
+			return -1;
+		}
+		if (blend[i].r != blend_scalar(bench_rgb16[i].r, over[i].r, COLOR_ALPHA_ONE / 3)
+			|| blend[i].g != blend_scalar(bench_rgb16[i].g, over[i].g, COLOR_ALPHA_ONE / 3)
+			|| blend[i].b != blend_scalar(bench_rgb16[i].b, over[i].b, COLOR_ALPHA_ONE / 3))
+		{
+			fprintf(stderr, "rgb16_blend_batch differs from the scalar blend at pixel %zu of %zu\n", i, n);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int cmd_bench(int argc, char** argv)
+{
+	size_t sizes[16] = { 1, 64, 4096 };
+	int count = 3;
+	if (argc > 0)
+	{
+		for (count = 0; count < argc && count < 16; ++count)
+		{
+			long n = strtol(argv[count], NULL, 0);
+			if (n < 1 || n > BENCH_MAX)
+			{
+				fprintf(stderr, "Pixel counts must be 1..%d\n", BENCH_MAX);
+				return 2;
+			}
+			sizes[count] = n;
+		}
+	}
+
+	bench_fill();
+	if (bench_boards() < 0)
+	{
+		fprintf(stderr, "Failed to set up the boards to quantise on\n");
+		return 1;
+	}
+	for (int s = 0; s < count; ++s)
+		if (bench_verify(sizes[s]) < 0)
+			return 1;
+
+	printf("# impl %s\n", color_batch_impl());
+	printf("# name pixels calls ns_per_pixel mpixels_per_s\n");
+	for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); ++b)
+	{
+		for (int s = 0; s < count; ++s)
+		{
+			size_t n = sizes[s];
+
+			// Warm the caches and the table before timing
+			benches[b].run(n);
+
+			uint64_t calls = 0, start = now_ns(), elapsed;
+			do
+			{
+				for (int i = 0; i < 64; ++i)
+					benches[b].run(n);
+				calls += 64;
+				elapsed = now_ns() - start;
+			} while (elapsed < BENCH_MIN_NS);
+
+			double ns = (double)elapsed / (calls * n);
+			printf("%s %zu %llu %.3f %.2f\n", benches[b].name, n, (unsigned long long)calls, ns, 1000.0 / ns);
+		}
+	}
+
+	return 0;
+}
+
+struct roundtrip_t
+{
+	unsigned long colors, exact;
+	unsigned int max_error;
+	unsigned long long total_error;
+	// Colours per largest channel error, the last bucket collects everything from 8 up
+	unsigned long hist[9];
+};
+
+static void roundtrip_add(struct roundtrip_t* rt, const rgb_t* a, const rgb_t* b)
+{
+	unsigned int er = abs(a->r - b->r), eg = abs(a->g - b->g), eb = abs(a->b - b->b);
+	unsigned int err = er > eg ? (er > eb ? er : eb) : (eg > eb ? eg : eb);
+
+	rt->colors++;
+	if (err == 0)
+		rt->exact++;
+	if (err > rt->max_error)
+		rt->max_error = err;
+	rt->total_error += er + eg + eb;
+	rt->hist[err < 8 ? err : 8]++;
+}
+
+static void roundtrip_print(const char* name, const struct roundtrip_t* rt)
+{
+	printf("%s.colors %lu\n", name, rt->colors);
+	printf("%s.exact %lu\n", name, rt->exact);
+	printf("%s.max_error %u\n", name, rt->max_error);
+	printf("%s.mean_error %.6f\n", name, rt->total_error / (3.0 * rt->colors));
+	printf("%s.error_hist", name);
+	for (int i = 0; i < 9; ++i)
+		printf(" %lu", rt->hist[i]);
+	printf("\n");
+}
+
+static int cmd_roundtrip()
+{
+	struct roundtrip_t rt8, rt16;
+	memset(&rt8, 0, sizeof(rt8));
+	memset(&rt16, 0, sizeof(rt16));
+
+	for (uint32_t c = 0; c < (1U << 24); ++c)
+	{
+		rgb_t in, out;
+		in.r = c >> 16;
+		in.g = c >> 8;
+		in.b = c;
+
+		hsv_t hsv;
+		rgb2hsv(&in, &hsv);
+		memset(&out, 0, sizeof(out));
+		hsv2rgb(&hsv, &out);
+		roundtrip_add(&rt8, &in, &out);
+
+		rgb16_t in16, out16;
+		in16.r = COLOR_8TO16(in.r);
+		in16.g = COLOR_8TO16(in.g);
+		in16.b = COLOR_8TO16(in.b);
+
+		hsv16_t hsv16;
+		rgb2hsv16(&in16, &hsv16);
+		hsv2rgb16(&hsv16, &out16);
+		out.r = COLOR_16TO8(out16.r);
+		out.g = COLOR_16TO8(out16.g);
+		out.b = COLOR_16TO8(out16.b);
+		roundtrip_add(&rt16, &in, &out);
+	}
+
+	roundtrip_print("hsv8", &rt8);
+	roundtrip_print("hsv16", &rt16);
+
+	return 0;
+}
+
+static int cmd_sweep(int argc, char** argv)
+{
+	temp_t temp;
+	temp.v = argc > 0 ? atof(argv[0]) : 1.f;
+
+	printf("# k r g b r16 g16 b16\n");
+	for (temp.k = 1000; temp.k <= 40000; temp.k += 100)
+	{
+		rgb_t rgb;
+		rgb16_t rgb16;
+		temperature2rgb(&temp, &rgb);
+		temperature2rgb16(&temp, &rgb16);
+
+		printf("%u %u %u %u %u %u %u\n", temp.k, rgb.r, rgb.g, rgb.b, rgb16.r, rgb16.g, rgb16.b);
+	}
+
+	return 0;
+}
+
+// Odd sized, so every batch ends in a partial block
+#define CHECK_CHUNK 4093
+
+static hsv_t check_hsv[CHECK_CHUNK];
+static rgb_t check_rgb[CHECK_CHUNK], check_want_rgb[CHECK_CHUNK];
+static hsv_t check_want_hsv[CHECK_CHUNK];
+
+// Every hue up to past the valid range, at every saturation and value
+static int check_hsv2rgb_batch()
+{
+	uint32_t total = 401 << 16;
+	for (uint32_t start = 0; start < total; start += CHECK_CHUNK)
+	{
+		size_t n = total - start < CHECK_CHUNK ? total - start : CHECK_CHUNK;
+		int want_ret = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			uint32_t c = start + i;
+			check_hsv[i].h = c >> 16;
+			check_hsv[i].s = c >> 8;
+			check_hsv[i].v = c;
+
+			// Out of range hues must leave the pixel as it was
+			check_rgb[i].r = check_want_rgb[i].r = c;
+			check_rgb[i].g = check_want_rgb[i].g = c >> 3;
+			check_rgb[i].b = check_want_rgb[i].b = c >> 5;
+			if (hsv2rgb(&check_hsv[i], &check_want_rgb[i]) < 0)
+				want_ret = -1;
+		}
+
+		int ret = hsv2rgb_batch(check_hsv, check_rgb, n);
+		if (ret != want_ret)
+		{
+			fprintf(stderr, "hsv2rgb_batch returned %d instead of %d for hues %u..%u\n", ret, want_ret, check_hsv[0].h, check_hsv[n - 1].h);
+			return -1;
+		}
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			const rgb_t* got = &check_rgb[i];
+			const rgb_t* want = &check_want_rgb[i];
+			if (got->r != want->r || got->g != want->g || got->b != want->b)
+			{
+				fprintf(stderr, "hsv2rgb_batch gives %u,%u,%u instead of %u,%u,%u for %u,%u,%u\n", got->r, got->g, got->b,
+					want->r, want->g, want->b, check_hsv[i].h, check_hsv[i].s, check_hsv[i].v);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int check_rgb2hsv_batch()
+{
+	uint32_t total = 1U << 24;
+	for (uint32_t start = 0; start < total; start += CHECK_CHUNK)
+	{
+		size_t n = total - start < CHECK_CHUNK ? total - start : CHECK_CHUNK;
+		for (size_t i = 0; i < n; ++i)
+		{
+			uint32_t c = start + i;
+			check_rgb[i].r = c >> 16;
+			check_rgb[i].g = c >> 8;
+			check_rgb[i].b = c;
+			rgb2hsv(&check_rgb[i], &check_want_hsv[i]);
+		}
+
+		rgb2hsv_batch(check_rgb, check_hsv, n);
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			const hsv_t* got = &check_hsv[i];
+			const hsv_t* want = &check_want_hsv[i];
+			if (got->h != want->h || got->s != want->s || got->v != want->v)
+			{
+				fprintf(stderr, "rgb2hsv_batch gives %u,%u,%u instead of %u,%u,%u for %u,%u,%u\n", got->h, got->s, got->v,
+					want->h, want->s, want->v, check_rgb[i].r, check_rgb[i].g, check_rgb[i].b);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static const float check_matrices[][9] = {
+	{ 1, 0, 0, 0, 1, 0, 0, 0, 1 },
+	// A fixture calibration, with the negative terms the low multiply has to get right
+	{ 0.92f, 0.11f, -0.03f, -0.06f, 0.87f, 0.19f, 0.02f, -0.24f, 1.21f },
+	// Every coefficient at the edge of the range
+	{ 4, -4, 4, -4, 4, -4, 4, -4, 4 },
+};
+#define CHECK_MATRICES (sizeof(check_matrices) / sizeof(check_matrices[0]))
+
+static const float check_gammas[][3] = {
+	{ 1, 1, 1 },
+	{ 2.2f, 2.2f, 2.2f },
+	{ 1.8f, 2.f, 2.4f },
+};
+#define CHECK_GAMMAS (sizeof(check_gammas) / sizeof(check_gammas[0]))
+
+static rgb16_t check_rgb16[CHECK_CHUNK], check_out16[CHECK_CHUNK];
+
+// Seeded noise, with black, white and the pure primaries first
+static void check_fill16(uint32_t seed)
+{
+	static const uint16_t corners[][3] = {
+		{ 0, 0, 0 }, { 65535, 65535, 65535 }, { 65535, 0, 0 }, { 0, 65535, 0 }, { 0, 0, 65535 }, { 1, 1, 1 }, { 65534, 65534, 65534 },
+	};
+	size_t n = sizeof(corners) / sizeof(corners[0]);
+
+	for (size_t i = 0; i < CHECK_CHUNK; ++i)
+	{
+		if (i < n)
+		{
+			check_rgb16[i].r = corners[i][0];
+			check_rgb16[i].g = corners[i][1];
+			check_rgb16[i].b = corners[i][2];
+			continue;
+		}
+
+		seed = seed * 1103515245 + 12345;
+		check_rgb16[i].r = seed >> 16;
+		seed = seed * 1103515245 + 12345;
+		check_rgb16[i].g = seed >> 16;
+		seed = seed * 1103515245 + 12345;
+		check_rgb16[i].b = seed >> 16;
+	}
+}
+
+static int32_t ccm_scalar(const int32_t* row, const rgb16_t* in)
+{
+	int32_t v = (row[0] * in->r + row[1] * in->g + row[2] * in->b + COLOR_CCM_ONE / 2) >> COLOR_CCM_SHIFT;
+	return v < 0 ? 0 : (v > 65535 ? 65535 : v);
+}
+
+// The vector matrix multiply against the plain integer sum it stands for
+static int check_rgb16_ccm_batch()
+{
+	for (size_t m = 0; m < CHECK_MATRICES; ++m)
+	{
+		int32_t matrix[9];
+		for (int i = 0; i < 9; ++i)
+			matrix[i] = roundf(check_matrices[m][i] * COLOR_CCM_ONE);
+
+		for (uint32_t pass = 0; pass < 64; ++pass)
+		{
+			check_fill16(pass + 1);
+			rgb16_ccm_batch(matrix, check_rgb16, check_out16, CHECK_CHUNK);
+
+			for (size_t i = 0; i < CHECK_CHUNK; ++i)
+			{
+				const rgb16_t* in = &check_rgb16[i];
+				const rgb16_t* got = &check_out16[i];
+				if (got->r != ccm_scalar(&matrix[0], in) || got->g != ccm_scalar(&matrix[3], in) || got->b != ccm_scalar(&matrix[6], in))
+				{
+					fprintf(stderr, "rgb16_ccm_batch gives %u,%u,%u instead of %d,%d,%d for %u,%u,%u with matrix %zu\n",
+						got->r, got->g, got->b, ccm_scalar(&matrix[0], in), ccm_scalar(&matrix[3], in), ccm_scalar(&matrix[6], in),
+						in->r, in->g, in->b, m);
+					return -1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+static uint8_t correct_float(const float* row, float gamma, const rgb16_t* in)
+{
+	float v = (row[0] * in->r + row[1] * in->g + row[2] * in->b) / 65535.f;
+	v = v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+	return powf(v, gamma) * 255.f + 0.5f;
+}
+
+// The Q10 matrix and the interpolated gamma tables, as the board quantises them, within one code of float maths
+static int check_board_correction()
+{
+	board_t board;
+	memset(&board, 0, sizeof(board));
+	board.ops = &null_ops;
+	board.pixels = CHECK_CHUNK;
+	if (board_start(&board) < 0)
+		return -1;
+
+	int ret = 0;
+	for (size_t m = 0; m < CHECK_MATRICES && ret == 0; ++m)
+	{
+		for (size_t g = 0; g < CHECK_GAMMAS && ret == 0; ++g)
+		{
+			if (board_set_correction(&board, check_matrices[m], check_gammas[g]) < 0)
+			{
+				ret = -1;
+				break;
+			}
+
+			for (uint32_t pass = 0; pass < 16 && ret == 0; ++pass)
+			{
+				check_fill16(pass + 1);
+				board_write_frame16(&board, check_rgb16, CHECK_CHUNK);
+
+				for (size_t i = 0; i < CHECK_CHUNK; ++i)
+				{
+					const rgb16_t* in = &check_rgb16[i];
+					const rgb_t* got = &board.quant[i];
+					uint8_t want[3];
+					for (int c = 0; c < 3; ++c)
+						want[c] = correct_float(&check_matrices[m][c * 3], check_gammas[g][c], in);
+
+					if (abs(got->r - want[0]) > 1 || abs(got->g - want[1]) > 1 || abs(got->b - want[2]) > 1)
+					{
+						fprintf(stderr, "Corrected %u,%u,%u to %u,%u,%u instead of %u,%u,%u with matrix %zu and gamma %zu\n",
+							in->r, in->g, in->b, got->r, got->g, got->b, want[0], want[1], want[2], m, g);
+						ret = -1;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	board_cleanup(&board);
+	return ret;
+}
+
+static const struct
+{
+	const char* name;
+	int (*run)();
+} checks[] = {
+	{ "hsv2rgb_batch", check_hsv2rgb_batch },
+	{ "rgb2hsv_batch", check_rgb2hsv_batch },
+	{ "rgb16_ccm_batch", check_rgb16_ccm_batch },
+	{ "board_correction", check_board_correction },
+};
+
+static int cmd_check()
+{
+	int ret = 0;
+
+	printf("# impl %s\n", color_batch_impl());
+	for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); ++c)
+	{
+		int ok = checks[c].run() == 0;
+		printf("%s %s\n", checks[c].name, ok ? "ok" : "FAILED");
+		if (!ok)
+			ret = 1;
+	}
+
+	return ret;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("Usage: %s COMMAND [ARGS...]\n\n"
+			"Commands:\n"
+			"  bench [PIXELS...] Check the batch kernels against the scalar calls, then time every\n"
+			"                    conversion per pixel (default 1, 64 and 4096 pixels)\n"
+			"  roundtrip         Convert all 16.7M colours to HSV and back, and report the error\n"
+			"  sweep [V]         Print temperature2rgb for 1000..40000K at brightness V (default 1)\n"
+			"  check             Compare the batch kernels with the scalar conversions, and colour\n"
+			"                    correction with float maths\n",
+			argv[0]);
+		return 2;
+	}
+
+	if (strcmp(argv[1], "bench") == 0)
+		return cmd_bench(argc - 2, argv + 2);
+	else if (strcmp(argv[1], "roundtrip") == 0)
+		return cmd_roundtrip();
+	else if (strcmp(argv[1], "sweep") == 0)
+		return cmd_sweep(argc - 2, argv + 2);
+	else if (strcmp(argv[1], "check") == 0)
+		return cmd_check();
+
+	fprintf(stderr, "Unknown command %s\n", argv[1]);
+	return 2;
+}
@@ -0,0 +1,86 @@
+#include "compose.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int compose_init(compose_t* compose, size_t pixels)
+{
+	memset(compose, 0, sizeof(compose_t));
+	compose->pixels = pixels;
+
+	for (int i = 0; i < compose_layer_count; ++i)
+	{
+		compose->layers[i].frame = calloc(pixels, sizeof(rgb16_t));
+		if (compose->layers[i].frame == NULL)
+			return -1;
+	}
+
+	compose->out = calloc(pixels, sizeof(rgb16_t));
+	if (compose->out == NULL)
+		return -1;
+
+	compose->layers[compose_base].active = 1;
+	compose->layers[compose_base].alpha = COLOR_ALPHA_ONE;
+	compose->dirty = 1U << compose_base;
+	compose->start = -1;
+
+	return 0;
+}
+
+void compose_cleanup(compose_t* compose)
+{
+	for (int i = 0; i < compose_layer_count; ++i)
+		free(compose->layers[i].frame);
+	free(compose->out);
+
+	memset(compose, 0, sizeof(compose_t));
+}
+
+rgb16_t* compose_layer(compose_t* compose, int layer, uint16_t alpha)
+{
+	compose_layer_t* l = &compose->layers[layer];
+	l->active = 1;
+	l->alpha = layer == compose_base ? COLOR_ALPHA_ONE : alpha;
+	compose->dirty |= 1U << layer;
+
+	return l->frame;
+}
+
+void compose_clear(compose_t* compose, int layer)
+{
+	if (layer == compose_base || !compose->layers[layer].active)
+		return;
+
+	compose->layers[layer].active = 0;
+	compose->dirty |= 1U << layer;
+}
+
+const rgb16_t* compose_frame(compose_t* compose)
+{
+	// Nothing under the topmost opaque layer can show, so start from there
+	int start = compose_base;
+	for (int i = compose_layer_count - 1; i > compose_base; --i)
+	{
+		if (compose->layers[i].active && compose->layers[i].alpha >= COLOR_ALPHA_ONE)
+		{
+			start = i;
+			break;
+		}
+	}
+
+	// Changes under it only matter once the layer that covered them goes away
+	if (start == compose->start && (compose->dirty >> start) == 0)
+		return compose->out;
+
+	memcpy(compose->out, compose->layers[start].frame, compose->pixels * sizeof(rgb16_t));
+	for (int i = start + 1; i < compose_layer_count; ++i)
+	{
+		const compose_layer_t* l = &compose->layers[i];
+		if (l->active && l->alpha > 0)
+			rgb16_blend_batch(compose->out, l->frame, l->alpha, compose->out, compose->pixels);
+	}
+
+	compose->start = start;
+	compose->dirty = 0;
+	return compose->out;
+}
@@ -0,0 +1,50 @@
+#ifndef _COMPOSE_H
+#define _COMPOSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+
+// Bottom to top, every layer is drawn over the ones below it
+enum compose_layer_id_t
+{
+	compose_base = 0,
+	compose_effect,
+	compose_overlay,
+
+	compose_layer_count
+};
+
+struct _compose_layer_t
+{
+	rgb16_t* frame;
+	int active;
+	// COLOR_ALPHA_ONE hides every layer below
+	uint16_t alpha;
+};
+typedef struct _compose_layer_t compose_layer_t;
+
+struct _compose_t
+{
+	size_t pixels;
+	compose_layer_t layers[compose_layer_count];
+
+	// Last composited frame, kept until a layer that shows through it changes
+	rgb16_t* out;
+	// Bit per layer changed since out was composited, and the layer it was composited from
+	unsigned int dirty;
+	int start;
+};
+typedef struct _compose_t compose_t;
+
+// The base layer is always active and opaque
+int compose_init(compose_t*, size_t pixels);
+void compose_cleanup(compose_t*);
+
+// Activates the layer and returns its frame for the caller to fill
+rgb16_t* compose_layer(compose_t*, int layer, uint16_t alpha);
+void compose_clear(compose_t*, int layer);
+// Composites the active layers, or returns the previous frame if nothing visible changed
+const rgb16_t* compose_frame(compose_t*);
+
+#endif
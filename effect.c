@@ -0,0 +1,185 @@
+#include "effect.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+const char* const effect_names[EFFECT_COUNT] = { "breathe", "colorloop", "candle" };
+
+#define BREATHE_PERIOD_MS 4000
+#define BREATHE_KEYS 16
+
+// Two seconds per sextant of the colour wheel
+#define COLORLOOP_PERIOD_MS 12000
+
+#define CANDLE_KEYS 48
+
+static int effect_alloc(effect_t* effect, size_t count)
+{
+	effect->keys = calloc(count, sizeof(effect_key_t));
+	if (effect->keys == NULL)
+		return -1;
+
+	effect->count = count;
+	return 0;
+}
+
+static void effect_scale(const rgb16_t* base, float r, float g, float b, rgb16_t* out)
+{
+	out->r = base->r * r;
+	out->g = base->g * g;
+	out->b = base->b * b;
+}
+
+// Precomputes the slope of every segment, so evaluating needs no division
+static void effect_link(effect_t* effect)
+{
+	for (size_t i = 0; i + 1 < effect->count; ++i)
+	{
+		effect_key_t* key = &effect->keys[i];
+		const effect_key_t* next = &effect->keys[i + 1];
+		int64_t dt = next->at_ms - key->at_ms;
+		if (dt <= 0)
+			continue;
+
+		key->slope[0] = ((int64_t)(next->color.r - key->color.r) << 16) / dt;
+		key->slope[1] = ((int64_t)(next->color.g - key->color.g) << 16) / dt;
+		key->slope[2] = ((int64_t)(next->color.b - key->color.b) << 16) / dt;
+	}
+
+	effect->period_ms = effect->keys[effect->count - 1].at_ms;
+}
+
+static int effect_compile_breathe(effect_t* effect, const rgb16_t* base)
+{
+	if (effect_alloc(effect, BREATHE_KEYS + 1) < 0)
+		return -1;
+
+	// Sampled raised cosine between 10% and full brightness
+	for (int i = 0; i <= BREATHE_KEYS; ++i)
+	{
+		float level = 0.1f + 0.9f * (1.f + cosf(2.f * (float)M_PI * i / BREATHE_KEYS)) / 2.f;
+		effect->keys[i].at_ms = i * BREATHE_PERIOD_MS / BREATHE_KEYS;
+		effect_scale(base, level, level, level, &effect->keys[i].color);
+	}
+
+	return 0;
+}
+
+static int effect_compile_colorloop(effect_t* effect, const rgb16_t* base)
+{
+	hsv16_t hsv;
+	rgb2hsv16(base, &hsv);
+	if (hsv.s == 0)
+		hsv.s = 65535;
+	if (hsv.v == 0)
+		hsv.v = 65535;
+
+	// hsv2rgb is linear in hue within a sextant, so one key per sextant is exact
+	if (effect_alloc(effect, 7) < 0)
+		return -1;
+
+	unsigned short hue = hsv.h;
+	for (int i = 0; i <= 6; ++i)
+	{
+		hsv.h = i * 60;
+		hsv2rgb16(&hsv, &effect->keys[i].color);
+		effect->keys[i].at_ms = i * COLORLOOP_PERIOD_MS / 6;
+	}
+
+	effect->phase_ms = (uint32_t)hue * COLORLOOP_PERIOD_MS / 360;
+	return 0;
+}
+
+static int effect_compile_candle(effect_t* effect, const rgb16_t* base)
+{
+	if (effect_alloc(effect, CANDLE_KEYS + 1) < 0)
+		return -1;
+
+	// Fixed seed, the flicker is random looking but the same every time it is compiled
+	uint32_t seed = 0x2545f491;
+	uint32_t at = 0;
+	for (int i = 0; i < CANDLE_KEYS; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		float level = 0.55f + 0.45f * ((seed >> 16) & 0xff) / 255.f;
+
+		// Dimmer flames are also redder
+		effect->keys[i].at_ms = at;
+		effect_scale(base, level, level * level, level * level * level, &effect->keys[i].color);
+
+		at += 40 + (seed >> 8 & 0x7f);
+	}
+
+	effect->keys[CANDLE_KEYS].at_ms = at;
+	effect->keys[CANDLE_KEYS].color = effect->keys[0].color;
+	return 0;
+}
+
+const char* effect_lookup(const char* name)
+{
+	for (int i = 0; i < EFFECT_COUNT; ++i)
+		if (strcasecmp(name, effect_names[i]) == 0)
+			return effect_names[i];
+
+	return NULL;
+}
+
+effect_t* effect_create(const char* name, const rgb16_t* base)
+{
+	effect_t* effect = calloc(1, sizeof(effect_t));
+	if (effect == NULL)
+		return NULL;
+
+	int ret = -1;
+	for (int i = 0; i < EFFECT_COUNT; ++i)
+	{
+		if (strcasecmp(name, effect_names[i]) != 0)
+			continue;
+
+		effect->name = effect_names[i];
+		if (i == 0)
+			ret = effect_compile_breathe(effect, base);
+		else if (i == 1)
+			ret = effect_compile_colorloop(effect, base);
+		else
+			ret = effect_compile_candle(effect, base);
+		break;
+	}
+
+	if (ret < 0)
+	{
+		effect_destroy(effect);
+		return NULL;
+	}
+
+	effect_link(effect);
+	return effect;
+}
+
+void effect_destroy(effect_t* effect)
+{
+	if (effect == NULL)
+		return;
+
+	free(effect->keys);
+	free(effect);
+}
+
+void effect_eval(effect_t* effect, uint64_t elapsed_ms, rgb16_t* out)
+{
+	uint32_t t = (elapsed_ms + effect->phase_ms) % effect->period_ms;
+
+	// Ticks move forward, so the segment search picks up where the last one ended
+	if (t < effect->keys[effect->segment].at_ms)
+		effect->segment = 0;
+	while (effect->segment + 2 < effect->count && t >= effect->keys[effect->segment + 1].at_ms)
+		effect->segment++;
+
+	const effect_key_t* key = &effect->keys[effect->segment];
+	int64_t dt = t - key->at_ms;
+	out->r = key->color.r + ((key->slope[0] * dt) >> 16);
+	out->g = key->color.g + ((key->slope[1] * dt) >> 16);
+	out->b = key->color.b + ((key->slope[2] * dt) >> 16);
+}
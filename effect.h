@@ -0,0 +1,47 @@
+#ifndef _EFFECT_H
+#define _EFFECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+
+// Effects that can be selected by name, besides "none"
+extern const char* const effect_names[];
+#define EFFECT_COUNT 3
+
+// One point on the timeline, the colour moves linearly towards the next key
+struct _effect_key_t
+{
+	uint32_t at_ms;
+	rgb16_t color;
+
+	// Change per millisecond until the next key, as 16.16 fixed point
+	int64_t slope[3];
+};
+typedef struct _effect_key_t effect_key_t;
+
+// A compiled effect, looping over its keys every period_ms
+struct _effect_t
+{
+	const char* name;
+
+	effect_key_t* keys;
+	size_t count;
+	uint32_t period_ms;
+	// Where in the loop the effect starts, e.g. the current hue for colorloop
+	uint32_t phase_ms;
+
+	// Key the last evaluation fell after, only ever moves forward until the loop wraps
+	size_t segment;
+};
+typedef struct _effect_t effect_t;
+
+// The table's spelling of an effect name, NULL if there is no such effect
+const char* effect_lookup(const char* name);
+// Compiles the named effect around a base colour, NULL if the name is unknown
+effect_t* effect_create(const char* name, const rgb16_t* base);
+void effect_destroy(effect_t*);
+
+void effect_eval(effect_t*, uint64_t elapsed_ms, rgb16_t* out);
+
+#endif
@@ -0,0 +1,64 @@
+// Generates temp_lut.h, the blackbody colours temperature2rgb looks up
+#include <math.h>
+#include <stdio.h>
+
+#define CLAMP(a, min, max) (a < min ? min : (a > max ? max : a))
+
+#define TEMP_MIN 1000
+#define TEMP_MAX 40000
+#define TEMP_STEP 100
+
+static void blackbody(unsigned short frac, unsigned char* r, unsigned char* g, unsigned char* b)
+{
+	float calc;
+	if (frac <= 66)
+		*r = 255;
+	else
+	{
+		calc = frac - 60;
+		calc = 329.698727446f * pow(calc, -0.1332047592f);
+		*r = CLAMP(calc, 0, 255);
+	}
+
+	if (frac <= 66)
+	{
+		calc = frac;
+		calc = 99.4708025861f * log(calc) - 161.1195681661f;
+		*g = CLAMP(calc, 0, 255);
+	}
+	else
+	{
+		calc = frac - 60;
+		calc = 288.1221695283f * pow(calc, -0.0755148492f);
+		*g = CLAMP(calc, 0, 255);
+	}
+
+	if (frac >= 66)
+		*b = 255;
+	else if (frac <= 19)
+		*b = 0;
+	else
+	{
+		calc = frac - 10;
+		calc = 138.5177312231f * log(calc) - 305.0447927307f;
+		*b = CLAMP(calc, 0, 255);
+	}
+}
+
+int main()
+{
+	printf("// Generated by gentemp, do not edit\n");
+	printf("#ifndef _TEMP_LUT_H\n#define _TEMP_LUT_H\n\n");
+	printf("#define TEMP_LUT_MIN %d\n#define TEMP_LUT_MAX %d\n#define TEMP_LUT_STEP %d\n\n", TEMP_MIN, TEMP_MAX, TEMP_STEP);
+	printf("static const rgb_t temp_lut[%d] = {\n", (TEMP_MAX - TEMP_MIN) / TEMP_STEP + 1);
+
+	for (int k = TEMP_MIN; k <= TEMP_MAX; k += TEMP_STEP)
+	{
+		unsigned char r, g, b;
+		blackbody(k / TEMP_STEP, &r, &g, &b);
+		printf("\t{ %3u, %3u, %3u }, // %dK\n", r, g, b, k);
+	}
+
+	printf("};\n\n#endif\n");
+	return 0;
+}
@@ -4,13 +4,62 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <linux/gpio.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define GPIO_FSEL_IN 0
+#define GPIO_FSEL_OUT 1
+
+// Raspberry Pi 1 to 4, as exposed through /dev/gpiomem
+const gpio_regmap_t gpio_regmap_bcm2835 = {
+	.name = "BCM2835",
+	.size = 0xB4,
+	.pins = 54,
+
+	.fsel = 0x00,
+	.set = 0x1C,
+	.clr = 0x28
+};
 
 int g_gpio_fd = -1;
 int g_gpio_pin_fds[GPIO_PINS];
+int g_gpio_lines_fd = -1;
+
+// Set when driving registers directly instead of through the character device
+const gpio_regmap_t* g_gpio_regmap = NULL;
+volatile uint32_t* g_gpio_regs = NULL;
+int g_gpio_pin_nums[GPIO_PINS];
+
+gpio_timing_t g_gpio_timing = {
+	.target_hz = GPIO_DEFAULT_CLOCK_HZ,
+	.half_period_ns = 1000000000U / (2 * GPIO_DEFAULT_CLOCK_HZ),
+	.ioctl_ns = 0,
+	.spin_ns = 1000000000U / (2 * GPIO_DEFAULT_CLOCK_HZ),
+	.achieved_hz = 0
+};
+
+static uint64_t gpio_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Busy-waits until a half-period has passed since the edge started
+static void gpio_hold(uint64_t since)
+{
+	if (g_gpio_timing.spin_ns == 0)
+		return;
+
+	uint64_t until = since + g_gpio_timing.half_period_ns;
+	while (gpio_now_ns() < until)
+		;
+}
 
 int gpio_init(uint8_t dev)
 {
@@ -46,15 +95,112 @@ int gpio_init(uint8_t dev)
 	return 0;
 }
 
+int gpio_init_mem(const char* path, const gpio_regmap_t* map)
+{
+	if (g_gpio_fd >= 0)
+		return 0;
+
+	memset(g_gpio_pin_fds, -1, sizeof(g_gpio_pin_fds));
+	memset(g_gpio_pin_nums, -1, sizeof(g_gpio_pin_nums));
+
+	int fd = open(path, O_RDWR | O_SYNC);
+	if (fd == -1) {
+		int ret = -errno;
+		fprintf(stderr, "Failed to open %s: %s (%d)\n", path, strerror(-ret), ret);
+
+		return ret;
+	}
+
+	// A plain file can stand in for the register block
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size < map->size && ftruncate(fd, map->size) < 0)
+	{
+		int ret = -errno;
+		fprintf(stderr, "Failed to size %s for the register block: %s (%d)\n", path, strerror(-ret), ret);
+		close(fd);
+		return ret;
+	}
+
+	void* regs = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (regs == MAP_FAILED)
+	{
+		int ret = -errno;
+		fprintf(stderr, "Failed to map GPIO registers from %s: %s (%d)\n", path, strerror(-ret), ret);
+		close(fd);
+		return ret;
+	}
+
+	g_gpio_fd = fd;
+	g_gpio_regmap = map;
+	g_gpio_regs = (volatile uint32_t*)regs;
+
+	printf("Attached to %s GPIO registers through %s with %d lines\n", map->name, path, map->pins);
+
+	return 0;
+}
+
+static int gpio_mem_export(uint8_t id, int pin, int dir)
+{
+	if (pin < 0 || pin >= g_gpio_regmap->pins)
+	{
+		fprintf(stderr, "Failed to export GPIO pin id %d as %d: no such pin on %s\n", id, pin, g_gpio_regmap->name);
+		return -EINVAL;
+	}
+
+	volatile uint32_t* fsel = &g_gpio_regs[(g_gpio_regmap->fsel / 4) + pin / 10];
+	uint32_t shift = (pin % 10) * 3;
+	*fsel = (*fsel & ~(7U << shift)) | ((dir == GPIO_IN ? GPIO_FSEL_IN : GPIO_FSEL_OUT) << shift);
+
+	g_gpio_pin_nums[id] = pin;
+
+	return 0;
+}
+
+// Sets and clears the pins behind the given ids with at most four register stores
+static void gpio_mem_write(uint64_t values, uint64_t mask)
+{
+	uint32_t set[2] = { 0, 0 }, clr[2] = { 0, 0 };
+	for (uint8_t id = 0; id < GPIO_PINS; ++id)
+	{
+		if ((mask & GPIO_LINE(id)) == 0 || g_gpio_pin_nums[id] < 0)
+			continue;
+
+		int pin = g_gpio_pin_nums[id];
+		if (values & GPIO_LINE(id))
+			set[pin / 32] |= 1U << (pin % 32);
+		else
+			clr[pin / 32] |= 1U << (pin % 32);
+	}
+
+	for (int bank = 0; bank < 2; ++bank)
+	{
+		if (set[bank])
+			g_gpio_regs[g_gpio_regmap->set / 4 + bank] = set[bank];
+		if (clr[bank])
+			g_gpio_regs[g_gpio_regmap->clr / 4 + bank] = clr[bank];
+	}
+}
+
 int gpio_uninit()
 {
 	if (g_gpio_fd < 0)
 		return 0;
 
-	for (size_t i = 0; i < 32; ++i)
+	if (g_gpio_regs != NULL)
+	{
+		munmap((void*)g_gpio_regs, g_gpio_regmap->size);
+		g_gpio_regs = NULL;
+		g_gpio_regmap = NULL;
+		g_gpio_lines_fd = -1;
+		memset(g_gpio_pin_nums, -1, sizeof(g_gpio_pin_nums));
+	}
+
+	for (size_t i = 0; i < GPIO_PINS; ++i)
 		if (g_gpio_pin_fds[i] >= 0)
 			gpio_unexport(i);
 
+	gpio_unexport_lines();
+
 	if (close(g_gpio_fd) < 0)
 	{
 		int ret = -errno;
@@ -72,6 +218,10 @@ int gpio_export(uint8_t id, int pin, int dir)
 {
 	if (g_gpio_fd < 0)
 		return -1;
+	if (id >= GPIO_PINS)
+		return -2;
+	if (g_gpio_regs != NULL)
+		return gpio_mem_export(id, pin, dir);
 
 	struct gpiohandle_request req;
 	req.lineoffsets[0] = pin;
@@ -94,9 +244,15 @@ int gpio_export(uint8_t id, int pin, int dir)
 
 int gpio_unexport(uint8_t id)
 {
-	if (id > GPIO_PINS)
+	if (id >= GPIO_PINS)
 		return -2;
 
+	if (g_gpio_regs != NULL)
+	{
+		g_gpio_pin_nums[id] = -1;
+		return 0;
+	}
+
 	if (g_gpio_pin_fds[id] <= 0)
 		return 0;
 
@@ -116,6 +272,11 @@ int gpio_write(uint8_t id, int value)
 {
 	if (g_gpio_fd < 0)
 		return -1;
+	if (g_gpio_regs != NULL)
+	{
+		gpio_mem_write(value == GPIO_HIGH ? GPIO_LINE(id) : 0, GPIO_LINE(id));
+		return 0;
+	}
 
 	struct gpiohandle_data data;
 	data.values[0] = value;
@@ -133,10 +294,196 @@ int gpio_write(uint8_t id, int value)
 
 int gpio_pulse(uint8_t id)
 {
-	gpio_write(id, GPIO_LOW);
-	usleep(GPIO_DELAY_MICROSEC);
-	gpio_write(id, GPIO_HIGH);
-	usleep(GPIO_DELAY_MICROSEC);
+	uint64_t edge = (g_gpio_timing.spin_ns > 0 ? gpio_now_ns() : 0);
+	int ret = gpio_write(id, GPIO_LOW);
+	if (ret < 0)
+		return ret;
+	gpio_hold(edge);
+
+	edge = (g_gpio_timing.spin_ns > 0 ? gpio_now_ns() : 0);
+	ret = gpio_write(id, GPIO_HIGH);
+	if (ret < 0)
+		return ret;
+	gpio_hold(edge);
+
+	return 0;
+}
+
+int gpio_export_lines(const int* pins, uint8_t count, int dir)
+{
+	if (g_gpio_fd < 0)
+		return -1;
+	if (count > GPIO_PINS)
+		return -2;
+
+	if (g_gpio_regs != NULL)
+	{
+		for (uint8_t i = 0; i < count; ++i)
+		{
+			int ret = gpio_mem_export(i, pins[i], dir);
+			if (ret < 0)
+				return ret;
+		}
+
+		// Registers take any mix of lines at once, like a multi-line handle
+		g_gpio_lines_fd = g_gpio_fd;
+		return 0;
+	}
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	struct gpio_v2_line_request req;
+	memset(&req, 0, sizeof(req));
+	for (uint8_t i = 0; i < count; ++i)
+		req.offsets[i] = pins[i];
+	req.num_lines = count;
+	req.config.flags = (dir == GPIO_IN ? GPIO_V2_LINE_FLAG_INPUT : GPIO_V2_LINE_FLAG_OUTPUT);
+	snprintf(req.consumer, GPIO_MAX_NAME_SIZE, "lightmeister_lines");
+
+	int ret = ioctl(g_gpio_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	if (ret < 0)
+	{
+		ret = -errno;
+		fprintf(stderr, "Failed to request %d GPIO lines (%s): %s (%d)\n", count, (dir == GPIO_OUT ? "OUT" : "IN"), strerror(-ret), ret);
+		return ret;
+	}
+
+	g_gpio_lines_fd = req.fd;
+
+	return 0;
+#else
+	(void)pins;
+	(void)count;
+	(void)dir;
+
+	return -ENOSYS;
+#endif
+}
+
+int gpio_unexport_lines()
+{
+	if (g_gpio_lines_fd < 0)
+		return 0;
+
+	if (g_gpio_regs != NULL)
+	{
+		memset(g_gpio_pin_nums, -1, sizeof(g_gpio_pin_nums));
+		g_gpio_lines_fd = -1;
+		return 0;
+	}
+
+	if (close(g_gpio_lines_fd) < 0)
+	{
+		int ret = -errno;
+		fprintf(stderr, "Failed to close GPIO lines: %s (%d)\n", strerror(-ret), ret);
+		return ret;
+	}
+
+	g_gpio_lines_fd = -1;
+
+	return 0;
+}
+
+int gpio_write_lines(uint64_t values, uint64_t mask)
+{
+	if (g_gpio_lines_fd < 0)
+		return -1;
+
+	if (g_gpio_regs != NULL)
+	{
+		gpio_mem_write(values, mask);
+		return 0;
+	}
+
+#ifdef GPIO_V2_LINE_SET_VALUES_IOCTL
+	struct gpio_v2_line_values data;
+	data.bits = values;
+	data.mask = mask;
+
+	int ret = ioctl(g_gpio_lines_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &data);
+	if (ret < 0)
+	{
+		ret = -errno;
+		fprintf(stderr, "Failed to write GPIO lines %#llx (mask %#llx): %s (%d)\n", (unsigned long long)values, (unsigned long long)mask, strerror(-ret), ret);
+		return ret;
+	}
+
+	return 0;
+#else
+	(void)values;
+	(void)mask;
+
+	return -ENOSYS;
+#endif
+}
+
+int gpio_pulse_lines(uint64_t values, uint64_t mask, uint64_t clock)
+{
+	// Other lines change together with the falling clock edge
+	uint64_t edge = (g_gpio_timing.spin_ns > 0 ? gpio_now_ns() : 0);
+	int ret = gpio_write_lines(values & ~clock, mask | clock);
+	if (ret < 0)
+		return ret;
+	gpio_hold(edge);
+
+	edge = (g_gpio_timing.spin_ns > 0 ? gpio_now_ns() : 0);
+	ret = gpio_write_lines(clock, clock);
+	if (ret < 0)
+		return ret;
+	gpio_hold(edge);
+
+	return 0;
+}
+
+int gpio_calibrate(uint8_t id, uint32_t hz)
+{
+	if (g_gpio_fd < 0)
+		return -1;
+	if (hz == 0)
+		return -2;
+
+	g_gpio_timing.target_hz = hz;
+	g_gpio_timing.half_period_ns = 1000000000U / (2 * hz);
+
+	// Measure the cost of one edge, leaving the clock line idle high
+	uint64_t start = gpio_now_ns();
+	for (int i = 0; i < GPIO_CALIBRATION_SAMPLES; ++i)
+	{
+		int ret = (g_gpio_lines_fd >= 0 ? gpio_write_lines(GPIO_LINE(id), GPIO_LINE(id)) : gpio_write(id, GPIO_HIGH));
+		if (ret < 0)
+			return ret;
+	}
+	g_gpio_timing.ioctl_ns = (gpio_now_ns() - start) / GPIO_CALIBRATION_SAMPLES;
+
+	if (g_gpio_timing.ioctl_ns >= g_gpio_timing.half_period_ns)
+		g_gpio_timing.spin_ns = 0;
+	else
+		g_gpio_timing.spin_ns = g_gpio_timing.half_period_ns - g_gpio_timing.ioctl_ns;
+
+	// Clock out idle pulses to see what the engine actually achieves
+	start = gpio_now_ns();
+	for (int i = 0; i < GPIO_CALIBRATION_SAMPLES; ++i)
+	{
+		int ret = (g_gpio_lines_fd >= 0 ? gpio_pulse_lines(0, 0, GPIO_LINE(id)) : gpio_pulse(id));
+		if (ret < 0)
+			return ret;
+	}
+	gpio_timing_record(GPIO_CALIBRATION_SAMPLES, gpio_now_ns() - start);
+
+	printf("GPIO clock target %uHz, one edge takes %uns, spinning %uns per half-period, achieved %uHz\n",
+		g_gpio_timing.target_hz, g_gpio_timing.ioctl_ns, g_gpio_timing.spin_ns, g_gpio_timing.achieved_hz);
 
 	return 0;
 }
+
+void gpio_timing_record(uint32_t bits, uint64_t ns)
+{
+	if (ns == 0)
+		return;
+
+	g_gpio_timing.achieved_hz = (uint32_t)(bits * 1000000000ULL / ns);
+}
+
+const gpio_timing_t* gpio_get_timing()
+{
+	return &g_gpio_timing;
+}
@@ -3,9 +3,12 @@
 
 #include <stdint.h>
 
-#define GPIO_PINS 2
+// One shared clock line and up to eight data lines
+#define GPIO_PINS 9
 
-#define GPIO_DELAY_MICROSEC 20
+// Same nominal clock as the old 20µs half-period sleeps
+#define GPIO_DEFAULT_CLOCK_HZ 25000
+#define GPIO_CALIBRATION_SAMPLES 256
 
 #define GPIO_LOW 0
 #define GPIO_HIGH 1
@@ -13,7 +16,42 @@
 #define GPIO_IN 0
 #define GPIO_OUT 1
 
+// Bit for pin id in a gpio_write_lines mask
+#define GPIO_LINE(id) (1ULL << (id))
+
+struct _gpio_timing_t
+{
+	uint32_t target_hz;
+	uint32_t half_period_ns;
+
+	// Measured at calibration, spin_ns is the part of a half-period the edge write doesn't cover
+	uint32_t ioctl_ns;
+	uint32_t spin_ns;
+
+	// Bit rate over the last recorded transfer
+	uint32_t achieved_hz;
+};
+typedef struct _gpio_timing_t gpio_timing_t;
+
+// Layout of a memory-mapped GPIO register block, offsets in bytes
+struct _gpio_regmap_t
+{
+	const char* name;
+	uint32_t size;
+	uint8_t pins;
+
+	// Three function select bits per pin, ten pins per register
+	uint32_t fsel;
+	// Banks of 32 pins each, writing a one sets or clears that pin
+	uint32_t set;
+	uint32_t clr;
+};
+typedef struct _gpio_regmap_t gpio_regmap_t;
+
+extern const gpio_regmap_t gpio_regmap_bcm2835;
+
 int gpio_init(uint8_t dev);
+int gpio_init_mem(const char* path, const gpio_regmap_t* map);
 int gpio_uninit();
 
 int gpio_export(uint8_t id, int pin, int dir);
@@ -21,4 +59,13 @@ int gpio_unexport(uint8_t id);
 int gpio_write(uint8_t id, int value);
 int gpio_pulse(uint8_t id);
 
+int gpio_export_lines(const int* pins, uint8_t count, int dir);
+int gpio_unexport_lines();
+int gpio_write_lines(uint64_t values, uint64_t mask);
+int gpio_pulse_lines(uint64_t values, uint64_t mask, uint64_t clock);
+
+int gpio_calibrate(uint8_t id, uint32_t hz);
+void gpio_timing_record(uint32_t bits, uint64_t ns);
+const gpio_timing_t* gpio_get_timing();
+
 #endif
@@ -0,0 +1,141 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static void print_record(const trace_t* trace, const trace_record_t* record, uint64_t base_ns)
+{
+	printf("%llu %.6f", (unsigned long long)record->seq, (record->timestamp_ns - base_ns) / 1e9);
+	for (uint32_t i = 0; i < trace->header->pixels; ++i)
+		printf(" %u,%u,%u", record->pixels[i].r, record->pixels[i].g, record->pixels[i].b);
+	printf("\n");
+}
+
+static int cmd_dump(const trace_t* trace, int paced)
+{
+	uint64_t first = trace_first(trace);
+	const trace_record_t* record = trace_get(trace, first);
+	if (record == NULL)
+		return 0;
+
+	uint64_t base_ns = record->timestamp_ns;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (uint64_t seq = first; (record = trace_get(trace, seq)) != NULL; ++seq)
+	{
+		if (paced)
+		{
+			// Replay with the recorded spacing between frames
+			uint64_t offset = record->timestamp_ns - base_ns;
+			struct timespec until = start;
+			until.tv_sec += offset / 1000000000ULL;
+			until.tv_nsec += offset % 1000000000ULL;
+			if (until.tv_nsec >= 1000000000L)
+			{
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+		}
+
+		print_record(trace, record, base_ns);
+		if (paced)
+			fflush(stdout);
+	}
+
+	return 0;
+}
+
+static int cmd_stats(const trace_t* trace)
+{
+	uint64_t first = trace_first(trace);
+	uint64_t written = trace->header->written;
+
+	printf("pixels %u\n", trace->header->pixels);
+	printf("capacity %u\n", trace->header->capacity);
+	printf("written %llu\n", (unsigned long long)written);
+	printf("kept %llu\n", (unsigned long long)(written - first));
+
+	const trace_record_t* head = trace_get(trace, first);
+	const trace_record_t* tail = trace_get(trace, written > 0 ? written - 1 : 0);
+	if (head == NULL || tail == NULL || tail == head)
+		return 0;
+
+	double span = (tail->timestamp_ns - head->timestamp_ns) / 1e9;
+	printf("span %.6f\n", span);
+	printf("fps %.2f\n", span > 0 ? (written - 1 - first) / span : 0);
+
+	return 0;
+}
+
+static int cmd_diff(const trace_t* a, const trace_t* b)
+{
+	if (a->header->pixels != b->header->pixels)
+	{
+		printf("pixel count differs: %u != %u\n", a->header->pixels, b->header->pixels);
+		return 1;
+	}
+
+	// Frames are compared in order, from the oldest one each trace still holds
+	uint64_t seq_a = trace_first(a), seq_b = trace_first(b);
+	const trace_record_t *ra, *rb;
+	uint64_t frames = 0, differing = 0;
+	size_t len = a->header->pixels * sizeof(rgb_t);
+
+	for (; (ra = trace_get(a, seq_a)) != NULL && (rb = trace_get(b, seq_b)) != NULL; ++seq_a, ++seq_b, ++frames)
+	{
+		if (memcmp(ra->pixels, rb->pixels, len) == 0)
+			continue;
+
+		if (differing++ == 0)
+			printf("first difference at frame %llu (seq %llu / %llu)\n", (unsigned long long)frames, (unsigned long long)seq_a, (unsigned long long)seq_b);
+	}
+
+	uint64_t left_a = a->header->written - seq_a, left_b = b->header->written - seq_b;
+	printf("compared %llu frames, %llu differ, %llu / %llu left over\n", (unsigned long long)frames, (unsigned long long)differing, (unsigned long long)left_a, (unsigned long long)left_b);
+
+	return (differing > 0 || left_a != left_b) ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3 || (strcmp(argv[1], "diff") == 0 && argc < 4))
+	{
+		printf("Usage: %s COMMAND TRACE [TRACE]\n\n"
+			"Commands:\n"
+			"  dump TRACE       Print every kept frame as seq, seconds and pixels\n"
+			"  replay TRACE     Print the frames with their recorded timing\n"
+			"  stats TRACE      Print frame counts and the recorded frame rate\n"
+			"  diff TRACE TRACE Compare two traces frame by frame\n",
+			argv[0]);
+		return 2;
+	}
+
+	trace_t trace;
+	if (trace_open(&trace, argv[2]) < 0)
+		return 2;
+
+	int ret = 2;
+	if (strcmp(argv[1], "dump") == 0)
+		ret = cmd_dump(&trace, 0);
+	else if (strcmp(argv[1], "replay") == 0)
+		ret = cmd_dump(&trace, 1);
+	else if (strcmp(argv[1], "stats") == 0)
+		ret = cmd_stats(&trace);
+	else if (strcmp(argv[1], "diff") == 0)
+	{
+		trace_t other;
+		if (trace_open(&other, argv[3]) == 0)
+		{
+			ret = cmd_diff(&trace, &other);
+			trace_close(&other);
+		}
+	}
+	else
+		fprintf(stderr, "Unknown command %s\n", argv[1]);
+
+	trace_close(&trace);
+	return ret;
+}
@@ -1,37 +1,69 @@
 #include "board.h"
+#include "circadian.h"
 #include "color.h"
+#include "effect.h"
 #include "gpio.h"
 #include "http.h"
 #include "mqtt.h"
+#include "output.h"
+#include "schedule.h"
 #include <strings.h>
 typedef struct mqtt_client mqtt_t;
 
 #include "posix_sockets.h"
 
 #include <ctype.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define LIGHTSTATE_OFF 0
 #define LIGHTSTATE_ON 1
 
 uint8_t mode = 255;
 int running;
+// Taken by the HTTP, MQTT and schedule threads around anything that reads or
+// changes the light state below, and around the MQTT send queue
+pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
 http_t server;
 board_t board;
+output_t output;
 mqtt_t mqtt;
+schedule_t schedule;
 
-rgb_t curCol;
-hsv_t curHSV;
+// Kept at 16 bits per channel, the board quantises to its own depth
+rgb16_t curCol;
+hsv16_t curHSV;
 temp_t curTemp;
 
-uint8_t curBright;
+uint16_t curBright;
+// Fade time for changes made over MQTT, HTTP requests carry their own
+uint32_t curTransition;
+// Name of the effect the output thread is running, any colour change ends it
+const char* curEffect = "none";
 
-rgb_t offCol;
+rgb16_t offCol;
 int lightState = LIGHTSTATE_OFF;
 
+// Follows the curve while curCol still holds what it last set, any other colour change ends it
+circadian_t circadian;
+int circadianOn;
+rgb16_t circadianCol;
+// Fade into the curve once when it is turned on, after that it moves too slowly to need one
+int circadianFade;
+unsigned int circadianK;
+uint8_t circadianBright;
+
+// Notification shown over everything else until it runs out, an overlay with
+// a lower priority can't replace it meanwhile
+rgb16_t overlayCol;
+float overlayAlpha;
+int overlayPriority;
+uint64_t overlayEnd;
+
 uint8_t *mqtt_sendbuf = NULL,
 	*mqtt_recvbuf = NULL;
 
@@ -46,6 +78,16 @@ struct mqtt_tosend
 struct mqtt_tosend mqtt_messages[MQTT_QUEUELEN];
 int mqtt_message_counter = 0;
 
+// Called with the state lock held, a message the worker hasn't sent yet is dropped for the new one
+struct mqtt_tosend* mqtt_next_message()
+{
+	struct mqtt_tosend *msg = &mqtt_messages[++mqtt_message_counter % MQTT_QUEUELEN];
+	free(msg->topic);
+	free(msg->message);
+	msg->ready = 0;
+	return msg;
+}
+
 int http_enabled = 0, mqtt_enabled = 0;
 pthread_t http_thread, mqtt_thread;
 
@@ -54,6 +96,8 @@ void reconnect_callback(mqtt_t* unused, void** reconnect_ptr);
 
 void* http_worker(void*);
 void* mqtt_worker(void*);
+void schedule_fire(const schedule_entry_t*, void*);
+void circadian_tick(int64_t now, void*);
 
 void sigint(int sig)
 {
@@ -69,6 +113,8 @@ void sigint(int sig)
 		http_close(&server);
 	if (mqtt.socketfd != 0)
 		mqtt_disconnect(&mqtt);
+	schedule_cleanup(&schedule);
+	output_cleanup(&output);
 	board_cleanup(&board);
 
 	if (mode == 1)
@@ -81,6 +127,21 @@ struct
 		uint16_t port;
 	} http;
 
+	struct {
+		uint32_t max_fps;
+		uint8_t rt_priority;
+		uint8_t cpu;
+		uint8_t dither;
+		uint32_t fade_fps;
+	} output;
+
+	struct {
+		float matrix[9];
+		uint8_t matrix_len;
+		float gamma[3];
+		uint8_t gamma_len;
+	} calibration;
+
 	struct {
 		const char* addr;
 		const char* topic;
@@ -90,14 +151,35 @@ struct
 		uint16_t port;
 	} mqtt;
 
-	union {
+	struct {
+		const char* path;
+	} schedule;
+
+	struct {
+		float lat, lon;
+		uint8_t located;
+	} circadian;
+
+	struct {
 		struct {
 			uint32_t speed;
-			uint8_t id;
+			board_spi_dev_t devs[SPI_MAX_BOARDS];
+			uint8_t count;
 		} spi;
 		struct {
+			const char* trace;
+			uint32_t frames;
+
+			const char* model;
+			uint32_t hz;
+			uint8_t virtual_time;
+		} dummy;
+		struct {
+			const char* gpiomem;
+			uint32_t hz;
 			uint8_t cpin,
-				dpin,
+				dpins[P9813_MAX_STRIPS],
+				strips,
 				len,
 				dev;
 		} p9813;
@@ -113,6 +195,11 @@ int main(int argc, char** argv)
 	args.mqtt.name = "";
 	args.mqtt.slug = "";
 	args.mqtt.publish = "";
+	args.schedule.path = "";
+	args.dummy.trace = "";
+	args.p9813.gpiomem = "";
+	args.dummy.model = "";
+	args.dummy.virtual_time = 0;
 
 	if (argc < 1)
 		return -1;
@@ -126,9 +213,41 @@ int main(int argc, char** argv)
 			mode = 1;
 		else if (strcmp(argv[i], "-D") == 0 || strcmp(argv[i], "--dummy") == 0)
 			mode = 2;
+		else if (strcmp(argv[i], "-Ps") == 0 || strcmp(argv[i], "--p9813-spi") == 0)
+			mode = 3;
 
 		else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--port") == 0)
 			args.http.port = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--max-fps") == 0)
+			args.output.max_fps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--rt-priority") == 0)
+			args.output.rt_priority = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--cpu") == 0)
+			args.output.cpu = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--fade-fps") == 0)
+			args.output.fade_fps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--dither") == 0)
+			args.output.dither = 1;
+		else if (strcmp(argv[i], "--ccm") == 0)
+		{
+			// Nine comma-separated coefficients, one row per output channel
+			char* coeff = strtok(argv[++i], ",");
+			for (args.calibration.matrix_len = 0; coeff != NULL && args.calibration.matrix_len < 9; coeff = strtok(NULL, ","))
+				args.calibration.matrix[args.calibration.matrix_len++] = atof(coeff);
+		}
+		else if (strcmp(argv[i], "--gamma") == 0)
+		{
+			char* gamma = strtok(argv[++i], ",");
+			for (args.calibration.gamma_len = 0; gamma != NULL && args.calibration.gamma_len < 3; gamma = strtok(NULL, ","))
+				args.calibration.gamma[args.calibration.gamma_len++] = atof(gamma);
+		}
+		else if (strcmp(argv[i], "--schedule") == 0)
+			args.schedule.path = argv[++i];
+		else if (strcmp(argv[i], "--location") == 0)
+		{
+			if (sscanf(argv[++i], "%f,%f", &args.circadian.lat, &args.circadian.lon) == 2)
+				args.circadian.located = 1;
+		}
 		else if (strcmp(argv[i], "-ma") == 0 || strcmp(argv[i], "--mqtt-addr") == 0)
 			args.mqtt.addr = argv[++i];
 		else if (strcmp(argv[i], "-mp") == 0 || strcmp(argv[i], "--mqtt-port") == 0)
@@ -146,19 +265,56 @@ int main(int argc, char** argv)
 		else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--hz") == 0)
 			args.spi.speed = atoi(argv[++i]);
 		else if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--id") == 0)
-			args.spi.id = atoi(argv[++i]);
+		{
+			// [BUS.CS:]ID, may be given once per board
+			const char* arg = argv[++i];
+			unsigned int bus = 0, cs = 0;
+			if (args.spi.count == UINT8_MAX)
+				args.spi.count = 0;
+
+			if (args.spi.count < SPI_MAX_BOARDS)
+			{
+				board_spi_dev_t* dev = &args.spi.devs[args.spi.count++];
+				if (strchr(arg, ':') != NULL && sscanf(arg, "%u.%u:", &bus, &cs) == 2)
+					arg = strchr(arg, ':') + 1;
+
+				dev->bus = bus;
+				dev->cs = cs;
+				dev->id = strtol(arg, NULL, 0);
+			}
+		}
 
 		else if (strcmp(argv[i], "--gpiochip") == 0)
 			args.p9813.dev = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--gpiomem") == 0)
+			args.p9813.gpiomem = argv[++i];
 		else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--clock") == 0)
 			args.p9813.cpin = atoi(argv[++i]);
 		else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--data") == 0)
-			args.p9813.dpin = atoi(argv[++i]);
+		{
+			// Comma-separated, one data pin per strip
+			char* pin = strtok(argv[++i], ",");
+			for (args.p9813.strips = 0; pin != NULL && args.p9813.strips < P9813_MAX_STRIPS; pin = strtok(NULL, ","))
+				args.p9813.dpins[args.p9813.strips++] = atoi(pin);
+		}
 		else if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--count") == 0)
 			args.p9813.len = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--trace") == 0)
+			args.dummy.trace = argv[++i];
+		else if (strcmp(argv[i], "--trace-frames") == 0)
+			args.dummy.frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--simulate") == 0)
+			args.dummy.model = argv[++i];
+		else if (strcmp(argv[i], "--sim-hz") == 0)
+			args.dummy.hz = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--sim-virtual") == 0)
+			args.dummy.virtual_time = 1;
+		else if (strcmp(argv[i], "--bitrate") == 0)
+			args.p9813.hz = atoi(argv[++i]);
 	}
 	if (args.http.port == UINT16_MAX) args.http.port = 4567;
 	if (args.mqtt.port == UINT16_MAX) args.mqtt.port = 1883;
+	if (args.output.max_fps == UINT32_MAX) args.output.max_fps = OUTPUT_DEFAULT_MAX_FPS;
 	if (strlen(args.mqtt.topic) == 0)
 		args.mqtt.topic = "light";
 	if (strlen(args.mqtt.name) == 0)
@@ -186,44 +342,87 @@ int main(int argc, char** argv)
 	if (mode == 0)
 	{
 		if (args.spi.speed == UINT32_MAX) args.spi.speed = 100000;
-		if (args.spi.id == UINT8_MAX) args.spi.id = 0x90;
-
-		if (board_init_spi(&board, 0, args.spi.speed) < 0)
+		if (args.spi.count == UINT8_MAX)
 		{
-			fprintf(stderr, "Failed to connect to light board, check SPI bus?\n");
-			return -1;
+			args.spi.count = 1;
+			memset(&args.spi.devs[0], 0, sizeof(board_spi_dev_t));
+			args.spi.devs[0].id = 0x90;
 		}
-		board.spi.id = args.spi.id;
-
-		printf("LED board #%i connected as %i with mode %i, bpw %i, speed %iHz\n", board.spi.id, board.spi.fd, board.spi.mode, board.spi.bpw, board.spi.speed);
 
-		if (board_set_pwm(&board) < 0)
+		if (board_init_spi(&board, args.spi.devs, args.spi.count, args.spi.speed) < 0)
 		{
-			fprintf(stderr, "Failed to set PWM on board\n");
+			fprintf(stderr, "Failed to connect to light board, check SPI bus?\n");
 			return -1;
 		}
+
+		for (uint8_t i = 0; i < board.spi.count; ++i)
+			printf("LED board #%i connected on spidev%i.%i with mode %i, bpw %i, speed %iHz\n", board.spi.devs[i].id, board.spi.devs[i].bus, board.spi.devs[i].cs, board.spi.mode, board.spi.bpw, board.spi.speed);
 	}
 	else if (mode == 1)
 	{
 		if (args.p9813.dev == UINT8_MAX) args.p9813.dev = 0;
-		if (gpio_init(args.p9813.dev) < 0)
+		if (strlen(args.p9813.gpiomem) != 0)
+		{
+			if (gpio_init_mem(args.p9813.gpiomem, &gpio_regmap_bcm2835) < 0)
+				return -1;
+		}
+		else if (gpio_init(args.p9813.dev) < 0)
 			return -1;
 
 		if (args.p9813.cpin == UINT8_MAX) args.p9813.cpin = 0;
-		if (args.p9813.dpin == UINT8_MAX) args.p9813.dpin = 1;
+		if (args.p9813.strips == UINT8_MAX)
+		{
+			args.p9813.strips = 1;
+			args.p9813.dpins[0] = 1;
+		}
 		if (args.p9813.len == UINT8_MAX) args.p9813.len = 1;
+		if (args.p9813.hz == UINT32_MAX) args.p9813.hz = GPIO_DEFAULT_CLOCK_HZ;
 
-		if (board_init_p9813(&board, args.p9813.cpin, args.p9813.dpin, args.p9813.len))
+		if (board_init_p9813(&board, args.p9813.cpin, args.p9813.dpins, args.p9813.strips, args.p9813.len, args.p9813.hz))
 		{
 			fprintf(stderr, "Failed to connect to light board, check output for more info\n");
 			return -1;
 		}
 
-		printf("LED board chain of %i P9813 IC(s) connected on pins clock: %i, data: %i\n", args.p9813.len, args.p9813.cpin, args.p9813.dpin);
+		printf("LED board chain of %i P9813 IC(s) connected on %i strip(s) with clock pin %i, first data pin %i\n", args.p9813.len, args.p9813.strips, args.p9813.cpin, args.p9813.dpins[0]);
 	}
 	else if (mode == 2)
 	{
-		board_init_dummy(&board);
+		if (args.p9813.len == UINT8_MAX) args.p9813.len = 1;
+
+		if (strlen(args.dummy.model) != 0)
+		{
+			if (args.dummy.hz == UINT32_MAX) args.dummy.hz = 0;
+
+			if (board_init_dummy_sim(&board, args.dummy.model, args.p9813.len, args.dummy.hz, args.dummy.virtual_time) < 0)
+				return -1;
+
+			printf("Simulating a %s bus with %i pixel(s)%s\n", args.dummy.model, args.p9813.len, args.dummy.virtual_time ? " in virtual time" : "");
+		}
+		else if (strlen(args.dummy.trace) == 0)
+			board_init_dummy(&board);
+		else
+		{
+			if (args.dummy.frames == UINT32_MAX) args.dummy.frames = 4096;
+
+			if (board_init_dummy_trace(&board, args.dummy.trace, args.p9813.len, args.dummy.frames) < 0)
+				return -1;
+
+			printf("Recording frames of %i pixel(s) into %s, keeping the last %u\n", args.p9813.len, args.dummy.trace, args.dummy.frames);
+		}
+	}
+	else if (mode == 3)
+	{
+		if (args.spi.speed == UINT32_MAX) args.spi.speed = 1000000;
+		if (args.p9813.len == UINT8_MAX) args.p9813.len = 1;
+
+		if (board_init_p9813_spi(&board, 0, 0, args.spi.speed, args.p9813.len) < 0)
+		{
+			fprintf(stderr, "Failed to connect to light board, check SPI bus?\n");
+			return -1;
+		}
+
+		printf("LED board chain of %i P9813 IC(s) connected over SPI as %i with speed %iHz\n", args.p9813.len, board.p9813_spi.fd, board.p9813_spi.speed);
 	}
 	else
 	{
@@ -232,8 +431,18 @@ int main(int argc, char** argv)
 			"  -S --spi         Use SPI connected BitWizard board\n"
 			"  -P --p9813       Use P9813 board\n"
 			"  -D --dummy       Use dummy board for testing\n"
+			"  -Ps --p9813-spi  Use P9813 board connected to the SPI bus\n"
 			"\n"
 			"  -p --port PORT   Specify the HTTP server port to use\n"
+			"  --max-fps FPS    Limit how often the board is written, 0 for no limit (default 60)\n"
+			"  --rt-priority N  Write to the board from a SCHED_FIFO thread with locked memory\n"
+			"  --cpu CPU        Pin the board output thread to a CPU\n"
+			"  --fade-fps FPS   Step transitions at this rate, up to the frame rate cap (default 50)\n"
+			"  --dither         Temporally dither levels between 8-bit codes, rewriting the board at the frame rate cap\n"
+			"  --ccm M,M,...    Correct colours for this fixture with a row-major 3x3 matrix (-4..4)\n"
+			"  --gamma G[,G,G]  Apply a gamma curve, per channel when given three values\n"
+			"  --schedule FILE  Keep scheduled changes in FILE across restarts\n"
+			"  --location LAT,LON Follow the sun at this location in circadian mode (default sunrise 07:00, sunset 19:00)\n"
 			"  -ma --mqtt-addr  Specify the MQTT server address to connect to\n"
 			"  -mp --mqtt-port  Specify the port of the MQTT server (default 1883)\n"
 			"  -mt --mqtt-topic Specify the default topic prefix to handle (default \"light\")\n"
@@ -241,17 +450,58 @@ int main(int argc, char** argv)
 			"  -mn --mqtt-name  Use the given name for this light instance\n"
 			"  -h --help        Display this text\n\n"
 			"SPI args:\n"
-			"  -h --hz HZ       Change the communication hertz (default 100 000)\n"
-			"  -i --id ID       Change the board ID (default 0x90)\n\n"
+			"  -h --hz HZ       Change the communication hertz (default 100 000, 1 000 000 for P9813)\n"
+			"  -i --id [BUS.CS:]ID Add a board by ID, optionally on another bus and chip-select (default 0.0:0x90)\n\n"
 			"P9813 args:\n"
 			"  --gpiochip DEV   The dev number for /dev/gpiochip* to use (default 0)\n"
+			"  --gpiomem PATH   Toggle the BCM2835 GPIO registers mapped from PATH (e.g. /dev/gpiomem) instead\n"
 			"  -c --clock PIN   The pin ID to use for the clock signal\n"
-			"  -d --data PIN    The pin ID to use for the data signal\n"
-			"  -n --count NUM   The number of controllers that are chained\n",
+			"  -d --data PIN[,PIN...] The pin ID(s) to use for the data signal, one per strip (up to 8)\n"
+			"  -n --count NUM   The number of controllers that are chained per strip (also for SPI)\n"
+			"  --bitrate HZ     The target clock rate for the chain (default 25 000)\n\n"
+			"Dummy args:\n"
+			"  --trace FILE     Record frames into a memory-mapped trace file instead of printing them\n"
+			"  --trace-frames NUM The number of frames the trace keeps (default 4096)\n"
+			"  --simulate BUS   Take as long as a p9813, p9813-spi or spi bus would for every write\n"
+			"  --sim-hz HZ      Override the clock rate of the simulated bus\n"
+			"  --sim-virtual    Only account the simulated bus time, without sleeping\n"
+			"  -n --count NUM   The number of pixels to record or simulate (default 1)\n",
 			argv[0]);
 		return mode == 255 ? -1 : 0;
 	}
 
+	if (board_start(&board) < 0)
+	{
+		fprintf(stderr, "Failed to set up %s board\n", board.ops->name);
+		return -1;
+	}
+	if (args.output.dither == 1 && board_set_dither(&board, 1) < 0)
+	{
+		fprintf(stderr, "Failed to set up dithering\n");
+		return -1;
+	}
+
+	if (args.calibration.matrix_len != UINT8_MAX || args.calibration.gamma_len != UINT8_MAX)
+	{
+		if (args.calibration.matrix_len != UINT8_MAX && args.calibration.matrix_len != 9)
+		{
+			fprintf(stderr, "--ccm takes 9 coefficients, got %i\n", args.calibration.matrix_len);
+			return -1;
+		}
+		if (args.calibration.gamma_len == 1)
+			args.calibration.gamma[1] = args.calibration.gamma[2] = args.calibration.gamma[0];
+		else if (args.calibration.gamma_len != UINT8_MAX && args.calibration.gamma_len != 3)
+		{
+			fprintf(stderr, "--gamma takes 1 or 3 values, got %i\n", args.calibration.gamma_len);
+			return -1;
+		}
+
+		if (board_set_correction(&board,
+				args.calibration.matrix_len == UINT8_MAX ? NULL : args.calibration.matrix,
+				args.calibration.gamma_len == UINT8_MAX ? NULL : args.calibration.gamma) < 0)
+			return -1;
+	}
+
 	memset(&curCol, 0, sizeof(curCol));
 	memset(&curHSV, 0, sizeof(curHSV));
 	memset(&curTemp, 0, sizeof(curTemp));
@@ -259,16 +509,39 @@ int main(int argc, char** argv)
 	memset(&offCol, 0, sizeof(offCol));
 
         // Start with pure white as the configured color
-	curCol.r = curCol.g = curCol.b = 255;
+	curCol.r = curCol.g = curCol.b = 65535;
 
-	if (board_write_rgb(&board, &offCol) < 0)
+	if (board_write_frame16(&board, &offCol, 1) < 0)
 	{
 		fprintf(stderr, "Failed to write initial RGB data to board\n");
 		return -1;
 	}
 
+	// From here on only the output thread touches the board
+	if (output_init(&output, &board, args.output.max_fps) < 0
+		|| output_set_realtime(&output, args.output.rt_priority == UINT8_MAX ? 0 : args.output.rt_priority, args.output.cpu == UINT8_MAX ? -1 : args.output.cpu) < 0
+		|| (args.output.fade_fps != UINT32_MAX && output_set_fade_fps(&output, args.output.fade_fps) < 0)
+		|| output_start(&output) < 0)
+	{
+		fprintf(stderr, "Failed to start output thread.\n");
+		return -1;
+	}
+
 	running = 1;
 
+	circadian_init(&circadian);
+	if (args.circadian.located == 1)
+		circadian_set_location(&circadian, args.circadian.lat, args.circadian.lon);
+
+	if (schedule_init(&schedule, strlen(args.schedule.path) > 0 ? args.schedule.path : NULL, schedule_fire, circadian_tick, NULL) < 0
+		|| schedule_start(&schedule) < 0)
+	{
+		fprintf(stderr, "Failed to start scheduler.\n");
+		return -1;
+	}
+	if (schedule.count > 0)
+		printf("Loaded %zu scheduled change(s) from %s\n", schedule.count, args.schedule.path);
+
 	memset(&server, 0, sizeof(server));
 	if (args.http.port != 0)
 	{
@@ -313,22 +586,26 @@ int main(int argc, char** argv)
 	if (strlen(args.mqtt.addr) != 0)
 		pthread_join(mqtt_thread, &status);
 
+	// Nothing to take requests, only run what was already scheduled
+	if (args.http.port == 0 && strlen(args.mqtt.addr) == 0 && schedule.count > 0)
+		pthread_join(schedule.thread, &status);
+
 	sigint(0);
 }
 
 void print_rgb()
 {
-	printf("New color: [ %i, %i, %i ]\n", curCol.r, curCol.g, curCol.b);
+	printf("New color: [ %i, %i, %i ]\n", COLOR_16TO8(curCol.r), COLOR_16TO8(curCol.g), COLOR_16TO8(curCol.b));
 }
 
 void print_hsv()
 {
-	printf("New color: [ %u, %.2f, %.2f ] => [ %i, %i, %i ]\n", curHSV.h, (curHSV.s / 255.f) * 100.f, (curHSV.v / 255.f) * 100.f, curCol.r, curCol.g, curCol.b);
+	printf("New color: [ %u, %.2f, %.2f ] => [ %i, %i, %i ]\n", curHSV.h, (curHSV.s / 65535.f) * 100.f, (curHSV.v / 65535.f) * 100.f, COLOR_16TO8(curCol.r), COLOR_16TO8(curCol.g), COLOR_16TO8(curCol.b));
 }
 
 void print_temp()
 {
-	printf("New color: %iK @%i%% => [ %i, %i, %i ]\n", curTemp.k, (int)(curTemp.v * 100), curCol.r, curCol.g, curCol.b);
+	printf("New color: %iK @%i%% => [ %i, %i, %i ]\n", curTemp.k, (int)(curTemp.v * 100), COLOR_16TO8(curCol.r), COLOR_16TO8(curCol.g), COLOR_16TO8(curCol.b));
 }
 
 void mqtt_publish_state()
@@ -336,7 +613,7 @@ void mqtt_publish_state()
 	if (mqtt_enabled == 0)
 		return;
 
-	struct mqtt_tosend *msg = &mqtt_messages[++mqtt_message_counter % MQTT_QUEUELEN];
+	struct mqtt_tosend *msg = mqtt_next_message();
 	msg->topic = malloc(128);
 	msg->message = malloc(4);
 	msg->flags = MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN;
@@ -349,12 +626,12 @@ void mqtt_publish_brightness()
 	if (mqtt_enabled == 0)
 		return;
 
-	struct mqtt_tosend *msg = &mqtt_messages[++mqtt_message_counter % MQTT_QUEUELEN];
+	struct mqtt_tosend *msg = mqtt_next_message();
 	msg->topic = malloc(128);
 	msg->message = malloc(4);
 	msg->flags = MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN;
 	snprintf(msg->topic, 128, "%s/brightness", args.mqtt.topic);
-	snprintf(msg->message, 4, "%u", curBright);
+	snprintf(msg->message, 4, "%u", COLOR_16TO8(curBright));
 	msg->ready = 1;
 }
 void mqtt_publish_temperature(int withBright)
@@ -362,7 +639,7 @@ void mqtt_publish_temperature(int withBright)
 	if (mqtt_enabled == 0)
 		return;
 
-	struct mqtt_tosend *msg = &mqtt_messages[++mqtt_message_counter % MQTT_QUEUELEN];
+	struct mqtt_tosend *msg = mqtt_next_message();
 	msg->topic = malloc(128);
 	msg->message = malloc(6);
 	msg->flags = MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN;
@@ -378,12 +655,12 @@ void mqtt_publish_rgb(int withBright)
 	if (mqtt_enabled == 0)
 		return;
 
-	struct mqtt_tosend *msg = &mqtt_messages[++mqtt_message_counter % MQTT_QUEUELEN];
+	struct mqtt_tosend *msg = mqtt_next_message();
 	msg->topic = malloc(128);
 	msg->message = malloc(12);
 	msg->flags = MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN;
 	snprintf(msg->topic, 128, "%s/rgb", args.mqtt.topic);
-	snprintf(msg->message, 12, "%u,%u,%u", curCol.r, curCol.g, curCol.b);
+	snprintf(msg->message, 12, "%u,%u,%u", COLOR_16TO8(curCol.r), COLOR_16TO8(curCol.g), COLOR_16TO8(curCol.b));
 	msg->ready = 1;
 
 	if (withBright == 1)
@@ -394,23 +671,337 @@ void mqtt_publish_color(int withBright)
 	if (mqtt_enabled == 0)
 		return;
 
-	struct mqtt_tosend *msg = &mqtt_messages[++mqtt_message_counter % MQTT_QUEUELEN];
+	struct mqtt_tosend *msg = mqtt_next_message();
 	msg->topic = malloc(128);
 	msg->message = malloc(8);
 	msg->flags = MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN;
 	snprintf(msg->topic, 128, "%s/color", args.mqtt.topic);
-	snprintf(msg->message, 8, "%u,%u", curHSV.h, (uint8_t)((curHSV.s / 255.f) * 100));
+	snprintf(msg->message, 8, "%u,%u", curHSV.h, (uint8_t)((curHSV.s / 65535.f) * 100));
 	msg->ready = 1;
 
 	if (withBright == 1)
 		mqtt_publish_brightness();
 }
 
+void mqtt_publish_effect()
+{
+	if (mqtt_enabled == 0)
+		return;
+
+	struct mqtt_tosend *msg = mqtt_next_message();
+	msg->topic = malloc(128);
+	msg->message = malloc(16);
+	msg->flags = MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN;
+	snprintf(msg->topic, 128, "%s/effect", args.mqtt.topic);
+	snprintf(msg->message, 16, "%s", curEffect);
+	msg->ready = 1;
+}
+
+void submit_color(const rgb16_t* color, uint32_t transition)
+{
+	// The output thread stops the effect itself when the frame arrives
+	if (strcmp(curEffect, "none") != 0)
+	{
+		curEffect = "none";
+		mqtt_publish_effect();
+	}
+
+	output_submit_rgb_fade(&output, color, transition);
+}
+
+int set_effect(const char* name)
+{
+	if (strcasecmp(name, "none") == 0)
+	{
+		// Go back to the colour the effect was started from
+		if (lightState == LIGHTSTATE_ON)
+			output_submit_rgb(&output, &curCol);
+		else
+			output_set_effect(&output, NULL);
+		curEffect = "none";
+		mqtt_publish_effect();
+		return 0;
+	}
+
+	// Effects run around the current colour, white if there is none to run around
+	rgb16_t base = curCol;
+	if (base.r == 0 && base.g == 0 && base.b == 0)
+		base.r = base.g = base.b = 65535;
+
+	effect_t* effect = effect_create(name, &base);
+	if (effect == NULL)
+	{
+		fprintf(stderr, "Unknown effect %s\n", name);
+		return -1;
+	}
+
+	curEffect = effect->name;
+	printf("New effect: %s\n", curEffect);
+	output_set_effect(&output, effect);
+
+	if (lightState != LIGHTSTATE_ON)
+	{
+		lightState = LIGHTSTATE_ON;
+		mqtt_publish_state();
+	}
+	mqtt_publish_effect();
+
+	return 0;
+}
+
+uint64_t now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+void mqtt_publish_circadian()
+{
+	if (mqtt_enabled == 0)
+		return;
+
+	struct mqtt_tosend *msg = mqtt_next_message();
+	msg->topic = malloc(128);
+	msg->message = malloc(4);
+	msg->flags = MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN;
+	snprintf(msg->topic, 128, "%s/circadian", args.mqtt.topic);
+	snprintf(msg->message, 4, "%s", circadianOn ? "on" : "off");
+	msg->ready = 1;
+}
+
+void set_circadian(int on)
+{
+	if (on == circadianOn)
+		return;
+
+	// Picked up by the next tick, which sees curCol unchanged
+	circadianCol = curCol;
+	circadianFade = 1;
+	circadianK = 0;
+	circadianOn = on;
+
+	printf("Circadian mode %s\n", on ? "on" : "off");
+	mqtt_publish_circadian();
+}
+
+static void circadian_step(int64_t now)
+{
+	if (!circadianOn)
+		return;
+
+	if (memcmp(&curCol, &circadianCol, sizeof(curCol)) != 0)
+	{
+		set_circadian(0);
+		return;
+	}
+
+	temp_t temp;
+	circadian_eval(&circadian, now, &temp);
+
+	rgb16_t col;
+	temperature2rgb16(&temp, &col);
+	if (memcmp(&col, &curCol, sizeof(col)) == 0 && !circadianFade)
+		return;
+
+	memset(&curHSV, 0, sizeof(curHSV));
+	curTemp = temp;
+	curCol = circadianCol = col;
+	curBright = (uint16_t)(temp.v * 65535);
+
+	// Effects keep running over the curve, the light picks it up again once they end
+	if (lightState == LIGHTSTATE_ON && strcmp(curEffect, "none") == 0)
+		output_submit_rgb_fade(&output, &curCol, circadianFade ? 1000 : 0);
+	circadianFade = 0;
+
+	// Only what subscribers can see changing is published again
+	if (temp.k != circadianK)
+		mqtt_publish_temperature(0);
+	if (COLOR_16TO8(curBright) != circadianBright)
+		mqtt_publish_brightness();
+	circadianK = temp.k;
+	circadianBright = COLOR_16TO8(curBright);
+}
+
+void circadian_tick(int64_t now, void* unused)
+{
+	(void)unused;
+
+	pthread_mutex_lock(&state_lock);
+	circadian_step(now);
+	pthread_mutex_unlock(&state_lock);
+}
+
+static void schedule_apply(const schedule_entry_t* entry)
+{
+	printf("Running scheduled %s change %u\n", schedule_action_names[entry->action], entry->id);
+
+	switch (entry->action)
+	{
+	case schedule_state:
+		lightState = entry->values[0] > 0 ? LIGHTSTATE_ON : LIGHTSTATE_OFF;
+		submit_color(lightState == LIGHTSTATE_ON ? &curCol : &offCol, entry->transition_ms);
+		mqtt_publish_state();
+		return;
+
+	case schedule_effect:
+		set_effect(entry->effect);
+		return;
+
+	case schedule_rgb:
+		memset(&curHSV, 0, sizeof(curHSV));
+		memset(&curTemp, 0, sizeof(curTemp));
+
+		curCol.r = COLOR_8TO16((uint8_t)entry->values[0]);
+		curCol.g = COLOR_8TO16((uint8_t)entry->values[1]);
+		curCol.b = COLOR_8TO16((uint8_t)entry->values[2]);
+		curBright = (uint16_t)((int)(curCol.r + curCol.g + curCol.b) / 3);
+
+		print_rgb();
+		mqtt_publish_rgb(1);
+		break;
+
+	case schedule_hsv:
+		memset(&curCol, 0, sizeof(curCol));
+		memset(&curTemp, 0, sizeof(curTemp));
+
+		curHSV.h = entry->values[0] > 360 ? 360 : (uint16_t)entry->values[0];
+		curHSV.s = (uint16_t)(entry->values[1] * 65535);
+		curHSV.v = (uint16_t)(entry->values[2] * 65535);
+		curBright = curHSV.v;
+		hsv2rgb16(&curHSV, &curCol);
+
+		print_hsv();
+		mqtt_publish_color(1);
+		break;
+
+	case schedule_temperature:
+		memset(&curCol, 0, sizeof(curCol));
+		memset(&curHSV, 0, sizeof(curHSV));
+
+		curTemp.k = (uint16_t)entry->values[0];
+		curTemp.v = entry->values[1];
+		curBright = (uint16_t)(curTemp.v * 65535);
+		temperature2rgb16(&curTemp, &curCol);
+
+		print_temp();
+		mqtt_publish_temperature(1);
+		break;
+	}
+
+	if (curCol.r > 0 || curCol.g > 0 || curCol.b > 0)
+		lightState = LIGHTSTATE_ON;
+	else
+		lightState = LIGHTSTATE_OFF;
+
+	submit_color(&curCol, entry->transition_ms);
+	mqtt_publish_state();
+}
+
+void schedule_fire(const schedule_entry_t* entry, void* unused)
+{
+	(void)unused;
+
+	pthread_mutex_lock(&state_lock);
+	schedule_apply(entry);
+	pthread_mutex_unlock(&state_lock);
+}
+
+int schedule_json(char* buf, const schedule_entry_t* entry)
+{
+	int len = sprintf(buf, "{\"id\":%u,\"at\":%lld,\"every\":%u,\"transition\":%.3f,\"action\":\"%s\"",
+		entry->id, (long long)entry->at, entry->every, entry->transition_ms / 1000.f, schedule_action_names[entry->action]);
+
+	if (entry->action == schedule_state)
+		len += sprintf(buf + len, ",\"state\":%i", entry->values[0] > 0 ? 1 : 0);
+	else if (entry->action == schedule_rgb)
+		len += sprintf(buf + len, ",\"r\":%i,\"g\":%i,\"b\":%i", (int)entry->values[0], (int)entry->values[1], (int)entry->values[2]);
+	else if (entry->action == schedule_hsv)
+		len += sprintf(buf + len, ",\"h\":%.2f,\"s\":%.2f,\"v\":%.2f", entry->values[0], entry->values[1], entry->values[2]);
+	else if (entry->action == schedule_temperature)
+		len += sprintf(buf + len, ",\"k\":%u,\"v\":%f", (unsigned int)entry->values[0], entry->values[1]);
+	else if (entry->action == schedule_effect)
+		len += sprintf(buf + len, ",\"effect\":\"%s\"", entry->effect);
+
+	len += sprintf(buf + len, "}");
+	return len;
+}
+
+// The answer to a request, built while the state lock is held and only sent once it is dropped,
+// so a slow client never holds up the MQTT or schedule threads
+struct http_reply_t
+{
+	// 200, 404 or 501, 0 to close without answering
+	int status;
+	const char* type;
+
+	// Kept between requests, only grows
+	char* body;
+	size_t len, size;
+};
+
+static void http_reply_ok(struct http_reply_t* reply, const char* type)
+{
+	reply->status = 200;
+	reply->type = type;
+}
+static void http_reply_not_found(struct http_reply_t* reply)
+{
+	reply->status = 404;
+}
+static void http_reply_not_implemented(struct http_reply_t* reply)
+{
+	reply->status = 501;
+}
+static void http_reply_send(struct http_reply_t* reply, const char* data)
+{
+	size_t len = strlen(data);
+	if (reply->len + len + 1 > reply->size)
+	{
+		size_t size = (reply->len + len + 1) * 2;
+		char* body = realloc(reply->body, size);
+		if (body == NULL)
+		{
+			fprintf(stderr, "Failed to allocate %zuB for an HTTP answer\n", size);
+			reply->status = 0;
+			return;
+		}
+		reply->body = body;
+		reply->size = size;
+	}
+
+	memcpy(reply->body + reply->len, data, len + 1);
+	reply->len += len;
+}
+
+// Drops the state lock before anything goes out to the client
+static void http_finish(http_req_t* client, struct http_reply_t* reply)
+{
+	pthread_mutex_unlock(&state_lock);
+
+	if (reply->status == 200)
+	{
+		http_req_ok(client, reply->type);
+		if (reply->len > 0)
+			http_req_send(client, reply->body);
+	}
+	else if (reply->status == 404)
+		http_req_not_found(client);
+	else if (reply->status == 501)
+		http_req_not_implemented(client);
+	http_req_close(client);
+
+	reply->status = 0;
+	reply->len = 0;
+}
+
 void* http_worker(void* unused)
 {
 	(void)unused;
 
 	http_req_t client;
+	struct http_reply_t reply;
+	memset(&reply, 0, sizeof(reply));
 	while (running)
 	{
 		if (http_accept(&server, &client) < 0)
@@ -421,6 +1012,8 @@ void* http_worker(void* unused)
 
 		printf("New request to %s %s\n", client.method, client.path);
 
+		pthread_mutex_lock(&state_lock);
+
 		if (strcmp(client.path, "/light/state") == 0)
 		{
 			if (strcasecmp(client.method, "GET") == 0)
@@ -444,12 +1037,15 @@ void* http_worker(void* unused)
 							data[i] = 0;
 
 					int state = -1;
+					uint32_t transition = 0;
 					for (i = 0; i < len;)
 					{
 						char* cur = &(data[i]);
 
 						i += strlen(cur) + 1;
-						if (strcasecmp(cur, "state") == 0)
+						if (strcasecmp(cur, "transition") == 0)
+							transition = (uint32_t)(atof(&(data[i])) * 1000);
+						else if (strcasecmp(cur, "state") == 0)
 						{
 							char* statestr = &data[i];
 							if (strcasecmp(statestr, "on") == 0 || strcmp(statestr, "1") == 0)
@@ -464,9 +1060,9 @@ void* http_worker(void* unused)
 						printf("Changing state from %d to %d\n", lightState, state);
 						lightState = state;
 						if (lightState == LIGHTSTATE_ON)
-							board_write_rgb(&board, &curCol);
+							submit_color(&curCol, transition);
 						else
-							board_write_rgb(&board, &offCol);
+							submit_color(&offCol, transition);
 						mqtt_publish_state();
 					}
 				}
@@ -474,14 +1070,14 @@ void* http_worker(void* unused)
 			else if (strcasecmp(client.method, "DELETE") == 0)
 			{
 				lightState = LIGHTSTATE_OFF;
-				board_write_rgb(&board, &offCol);
+				submit_color(&offCol, 0);
 				mqtt_publish_state();
 			}
 
 			char buf[128];
-			http_req_ok(&client, "application/json");
+			http_reply_ok(&reply, "application/json");
 			sprintf(buf, "{\"state\":%i}\n", lightState);
-			http_req_send(&client, buf);
+			http_reply_send(&reply, buf);
 		}
 		else if (strcmp(client.path, "/light/temperature") == 0)
 		{
@@ -508,19 +1104,22 @@ void* http_worker(void* unused)
 						if (data[i] == '&' || data[i] == '=')
 							data[i] = 0;
 
+					uint32_t transition = 0;
 					for (i = 0; i < len;)
 					{
 						char* cur = &(data[i]);
 
 						i += strlen(cur) + 1;
-						if (strcasecmp(cur, "k") == 0 || strcasecmp(cur, "temp") == 0 || strcasecmp(cur, "temperature") == 0)
+						if (strcasecmp(cur, "transition") == 0)
+							transition = (uint32_t)(atof(&(data[i])) * 1000);
+						else if (strcasecmp(cur, "k") == 0 || strcasecmp(cur, "temp") == 0 || strcasecmp(cur, "temperature") == 0)
 							curTemp.k = atoi(&(data[i]));
 						else if (strcasecmp(cur, "v") == 0 || strcasecmp(cur, "value") == 0)
 							curTemp.v = atof(&(data[i]));
 					}
 
-					curBright = (uint8_t)(curTemp.v * 255);
-					temperature2rgb(&curTemp, &curCol);
+					curBright = (uint16_t)(curTemp.v * 65535);
+					temperature2rgb16(&curTemp, &curCol);
 
 					if (curCol.r > 0 || curCol.g > 0 || curCol.b > 0)
 						lightState = LIGHTSTATE_ON;
@@ -528,7 +1127,7 @@ void* http_worker(void* unused)
 						lightState = LIGHTSTATE_OFF;
 
 					print_temp();
-					board_write_rgb(&board, &curCol);
+					submit_color(&curCol, transition);
 
 					mqtt_publish_temperature(1);
 					mqtt_publish_state();
@@ -541,16 +1140,16 @@ void* http_worker(void* unused)
 				curBright = 0;
 				memset(&curTemp, 0, sizeof(curTemp));
 				memset(&curCol, 0, sizeof(curCol));
-				board_write_rgb(&board, &curCol);
+				submit_color(&curCol, 0);
 
 				mqtt_publish_temperature(1);
 				mqtt_publish_state();
 			}
 
 			char buf[128];
-			http_req_ok(&client, "application/json");
+			http_reply_ok(&reply, "application/json");
 			sprintf(buf, "{\"k\":%u,\"v\":%f}\n", curTemp.k, curTemp.v);
-			http_req_send(&client, buf);
+			http_reply_send(&reply, buf);
 		}
 		else if (strcmp(client.path, "/light/rgb") == 0)
 		{
@@ -577,17 +1176,20 @@ void* http_worker(void* unused)
 						if (data[i] == '&' || data[i] == '=')
 							data[i] = 0;
 
+					uint32_t transition = 0;
 					for (i = 0; i < len;)
 					{
 						char* cur = &(data[i]);
 
 						i += strlen(cur) + 1;
-						if (strcasecmp(cur, "r") == 0 || strcasecmp(cur, "red") == 0)
-							curCol.r = atoi(&(data[i]));
+						if (strcasecmp(cur, "transition") == 0)
+							transition = (uint32_t)(atof(&(data[i])) * 1000);
+						else if (strcasecmp(cur, "r") == 0 || strcasecmp(cur, "red") == 0)
+							curCol.r = COLOR_8TO16(atoi(&(data[i])));
 						else if (strcasecmp(cur, "g") == 0 || strcasecmp(cur, "green") == 0)
-							curCol.g = atoi(&(data[i]));
+							curCol.g = COLOR_8TO16(atoi(&(data[i])));
 						else if (strcasecmp(cur, "b") == 0 || strcasecmp(cur, "blue") == 0)
-							curCol.b = atoi(&(data[i]));
+							curCol.b = COLOR_8TO16(atoi(&(data[i])));
 					}
 
 					if (curCol.r > 0 || curCol.g > 0 || curCol.b > 0)
@@ -595,10 +1197,10 @@ void* http_worker(void* unused)
 					else
 						lightState = LIGHTSTATE_OFF;
 
-					curBright = (uint8_t)((int)(curCol.r + curCol.g + curCol.b) / 3);
+					curBright = (uint16_t)((int)(curCol.r + curCol.g + curCol.b) / 3);
 
 					print_rgb();
-					board_write_rgb(&board, &curCol);
+					submit_color(&curCol, transition);
 
 					mqtt_publish_rgb(1);
 					mqtt_publish_state();
@@ -610,22 +1212,22 @@ void* http_worker(void* unused)
 				curBright = 0;
 
 				memset(&curCol, 0, sizeof(curCol));
-				board_write_rgb(&board, &curCol);
+				submit_color(&curCol, 0);
 
 				mqtt_publish_rgb(1);
 				mqtt_publish_state();
 			}
 			else
 			{
-				http_req_not_implemented(&client);
-				http_req_close(&client);
+				http_reply_not_implemented(&reply);
+				http_finish(&client, &reply);
 				continue;
 			}
 
 			char buf[128];
-			http_req_ok(&client, "application/json");
-			sprintf(buf, "{\"r\":%i,\"g\":%i,\"b\":%i}\n", curCol.r, curCol.g, curCol.b);
-			http_req_send(&client, buf);
+			http_reply_ok(&reply, "application/json");
+			sprintf(buf, "{\"r\":%i,\"g\":%i,\"b\":%i}\n", COLOR_16TO8(curCol.r), COLOR_16TO8(curCol.g), COLOR_16TO8(curCol.b));
+			http_reply_send(&reply, buf);
 		}
 		else if (strcmp(client.path, "/light/hsv") == 0)
 		{
@@ -652,24 +1254,27 @@ void* http_worker(void* unused)
 						if (data[i] == '&' || data[i] == '=')
 							data[i] = 0;
 
+					uint32_t transition = 0;
 					for (i = 0; i < len;)
 					{
 						char* cur = &(data[i]);
 
 						i += strlen(cur) + 1;
-						if (strcasecmp(cur, "h") == 0 || strcasecmp(cur, "hue") == 0)
+						if (strcasecmp(cur, "transition") == 0)
+							transition = (uint32_t)(atof(&(data[i])) * 1000);
+						else if (strcasecmp(cur, "h") == 0 || strcasecmp(cur, "hue") == 0)
 							curHSV.h = (uint16_t)(atoi(data + i));
 						else if (strcasecmp(cur, "s") == 0 || strcasecmp(cur, "saturation") == 0)
-							curHSV.s = (uint8_t)(atof(data + i) * 255);
+							curHSV.s = (uint16_t)(atof(data + i) * 65535);
 						else if (strcasecmp(cur, "v") == 0 || strcasecmp(cur, "value") == 0)
-							curHSV.v = (uint8_t)(atof(data + i) * 255);
+							curHSV.v = (uint16_t)(atof(data + i) * 65535);
 					}
 
 					if (curHSV.h > 360)
 						curHSV.h = 360;
 
 					curBright = curHSV.v;
-					hsv2rgb(&curHSV, &curCol);
+					hsv2rgb16(&curHSV, &curCol);
 
 					if (curCol.r > 0 || curCol.g > 0 || curCol.b > 0)
 						lightState = LIGHTSTATE_ON;
@@ -677,7 +1282,7 @@ void* http_worker(void* unused)
 						lightState = LIGHTSTATE_OFF;
 
 					print_hsv();
-					board_write_rgb(&board, &curCol);
+					submit_color(&curCol, transition);
 
 					mqtt_publish_color(1);
 					mqtt_publish_state();
@@ -690,30 +1295,398 @@ void* http_worker(void* unused)
 
 				memset(&curHSV, 0, sizeof(curHSV));
 				memset(&curCol, 0, sizeof(curCol));
-				board_write_rgb(&board, &curCol);
+				submit_color(&curCol, 0);
 
 				mqtt_publish_color(1);
 				mqtt_publish_state();
 			}
 			else
 			{
-				http_req_not_implemented(&client);
-				http_req_close(&client);
+				http_reply_not_implemented(&reply);
+				http_finish(&client, &reply);
 				continue;
 			}
 
 			char buf[128];
-			http_req_ok(&client, "application/json");
-			sprintf(buf, "{\"h\":%.2f,\"s\":%.2f,\"v\":%.2f}\n", (curHSV.h / 255.f) * 360.f, curHSV.s / 255.f, curHSV.v / 255.f);
-			http_req_send(&client, buf);
+			http_reply_ok(&reply, "application/json");
+			sprintf(buf, "{\"h\":%.2f,\"s\":%.2f,\"v\":%.2f}\n", (float)curHSV.h, curHSV.s / 65535.f, curHSV.v / 65535.f);
+			http_reply_send(&reply, buf);
+		}
+		else if (strcmp(client.path, "/light/effect") == 0)
+		{
+			if (strcasecmp(client.method, "GET") == 0)
+			{
+			}
+			else if (strcasecmp(client.method, "PUT") == 0 || strcasecmp(client.method, "POST") == 0)
+			{
+				if (client.content_length >= 1 || client.query != NULL)
+				{
+					size_t len = client.content_length;
+					char* data = client.content;
+					if (client.content_length < 1)
+					{
+						data = client.query;
+						len = strlen(data);
+					}
+
+					size_t i;
+					for (i = 0; i < len; ++i)
+						if (data[i] == '&' || data[i] == '=')
+							data[i] = 0;
+
+					for (i = 0; i < len;)
+					{
+						char* cur = &(data[i]);
+
+						i += strlen(cur) + 1;
+						if (strcasecmp(cur, "effect") == 0 || strcasecmp(cur, "name") == 0)
+							set_effect(&(data[i]));
+					}
+				}
+			}
+			else if (strcasecmp(client.method, "DELETE") == 0)
+				set_effect("none");
+			else
+			{
+				http_reply_not_implemented(&reply);
+				http_finish(&client, &reply);
+				continue;
+			}
+
+			char buf[256];
+			int len = sprintf(buf, "{\"effect\":\"%s\",\"effects\":[\"none\"", curEffect);
+			for (int i = 0; i < EFFECT_COUNT; ++i)
+				len += sprintf(buf + len, ",\"%s\"", effect_names[i]);
+			sprintf(buf + len, "]}\n");
+
+			http_reply_ok(&reply, "application/json");
+			http_reply_send(&reply, buf);
+		}
+		else if (strcmp(client.path, "/light/overlay") == 0)
+		{
+			if (strcasecmp(client.method, "GET") == 0)
+			{
+			}
+			else if (strcasecmp(client.method, "PUT") == 0 || strcasecmp(client.method, "POST") == 0)
+			{
+				if (client.content_length >= 3 || client.query != NULL)
+				{
+					size_t len = client.content_length;
+					char* data = client.content;
+					if (client.content_length < 3)
+					{
+						data = client.query;
+						len = strlen(data);
+					}
+
+					size_t i;
+					for (i = 0; i < len; ++i)
+						if (data[i] == '&' || data[i] == '=')
+							data[i] = 0;
+
+					rgb16_t color = { 0, 0, 0 };
+					float alpha = 1.f, ttl = 1.f;
+					int priority = 0;
+					for (i = 0; i < len;)
+					{
+						char* cur = &(data[i]);
+
+						i += strlen(cur) + 1;
+						if (strcasecmp(cur, "r") == 0 || strcasecmp(cur, "red") == 0)
+							color.r = COLOR_8TO16(atoi(&(data[i])));
+						else if (strcasecmp(cur, "g") == 0 || strcasecmp(cur, "green") == 0)
+							color.g = COLOR_8TO16(atoi(&(data[i])));
+						else if (strcasecmp(cur, "b") == 0 || strcasecmp(cur, "blue") == 0)
+							color.b = COLOR_8TO16(atoi(&(data[i])));
+						else if (strcasecmp(cur, "alpha") == 0 || strcasecmp(cur, "a") == 0)
+							alpha = atof(&(data[i]));
+						else if (strcasecmp(cur, "ttl") == 0)
+							ttl = atof(&(data[i]));
+						else if (strcasecmp(cur, "priority") == 0)
+							priority = atoi(&(data[i]));
+					}
+
+					if (alpha < 0.f)
+						alpha = 0.f;
+					else if (alpha > 1.f)
+						alpha = 1.f;
+
+					uint64_t now = now_ms();
+					if (ttl <= 0.f)
+						fprintf(stderr, "Overlay needs a ttl above 0\n");
+					else if (now < overlayEnd && priority < overlayPriority)
+						printf("Keeping overlay with priority %d over %d\n", overlayPriority, priority);
+					else
+					{
+						overlayCol = color;
+						overlayAlpha = alpha;
+						overlayPriority = priority;
+						overlayEnd = now + (uint64_t)(ttl * 1000);
+
+						printf("New overlay: [ %i, %i, %i ] @%i%% for %.2fs\n", COLOR_16TO8(color.r), COLOR_16TO8(color.g), COLOR_16TO8(color.b), (int)(alpha * 100), ttl);
+						output_submit_overlay_rgb(&output, &overlayCol, (uint16_t)(alpha * COLOR_ALPHA_ONE), (uint32_t)(ttl * 1000));
+					}
+				}
+			}
+			else if (strcasecmp(client.method, "DELETE") == 0)
+			{
+				overlayEnd = 0;
+				output_clear_overlay(&output);
+			}
+			else
+			{
+				http_reply_not_implemented(&reply);
+				http_finish(&client, &reply);
+				continue;
+			}
+
+			uint64_t now = now_ms();
+			float left = now < overlayEnd ? (overlayEnd - now) / 1000.f : 0.f;
+
+			char buf[128];
+			http_reply_ok(&reply, "application/json");
+			sprintf(buf, "{\"r\":%i,\"g\":%i,\"b\":%i,\"alpha\":%.2f,\"priority\":%d,\"ttl\":%.2f}\n", COLOR_16TO8(overlayCol.r), COLOR_16TO8(overlayCol.g), COLOR_16TO8(overlayCol.b), overlayAlpha, overlayPriority, left);
+			http_reply_send(&reply, buf);
+		}
+		else if (strcmp(client.path, "/light/schedule") == 0)
+		{
+			if (strcasecmp(client.method, "GET") == 0)
+			{
+			}
+			else if (strcasecmp(client.method, "PUT") == 0 || strcasecmp(client.method, "POST") == 0)
+			{
+				schedule_entry_t entry;
+				memset(&entry, 0, sizeof(entry));
+				entry.action = -1;
+
+				if (client.content_length >= 3 || client.query != NULL)
+				{
+					size_t len = client.content_length;
+					char* data = client.content;
+					if (client.content_length < 3)
+					{
+						data = client.query;
+						len = strlen(data);
+					}
+
+					size_t i;
+					for (i = 0; i < len; ++i)
+						if (data[i] == '&' || data[i] == '=')
+							data[i] = 0;
+
+					// Brightness defaults to full, unlike the colour endpoints there is no current value to keep
+					float v = 1.f;
+					for (i = 0; i < len;)
+					{
+						char* cur = &(data[i]);
+
+						i += strlen(cur) + 1;
+						if (strcasecmp(cur, "at") == 0)
+							entry.at = atoll(&(data[i]));
+						else if (strcasecmp(cur, "in") == 0)
+							entry.at = time(NULL) + atoll(&(data[i]));
+						else if (strcasecmp(cur, "every") == 0)
+							entry.every = atoi(&(data[i]));
+						else if (strcasecmp(cur, "transition") == 0)
+							entry.transition_ms = (uint32_t)(atof(&(data[i])) * 1000);
+						else if (strcasecmp(cur, "state") == 0)
+						{
+							entry.action = schedule_state;
+							entry.values[0] = strcasecmp(&(data[i]), "on") == 0 || strcmp(&(data[i]), "1") == 0;
+						}
+						else if (strcasecmp(cur, "effect") == 0)
+						{
+							entry.action = schedule_effect;
+							strncpy(entry.effect, &(data[i]), sizeof(entry.effect) - 1);
+						}
+						else if (strcasecmp(cur, "r") == 0 || strcasecmp(cur, "g") == 0 || strcasecmp(cur, "b") == 0)
+						{
+							entry.action = schedule_rgb;
+							entry.values[strchr("rgb", tolower(cur[0])) - "rgb"] = atoi(&(data[i]));
+						}
+						else if (strcasecmp(cur, "h") == 0 || strcasecmp(cur, "s") == 0)
+						{
+							entry.action = schedule_hsv;
+							entry.values[tolower(cur[0]) == 'h' ? 0 : 1] = atof(&(data[i]));
+						}
+						else if (strcasecmp(cur, "k") == 0)
+						{
+							entry.action = schedule_temperature;
+							entry.values[0] = atoi(&(data[i]));
+						}
+						else if (strcasecmp(cur, "v") == 0)
+							v = atof(&(data[i]));
+					}
+
+					if (entry.action == schedule_hsv)
+						entry.values[2] = v;
+					else if (entry.action == schedule_temperature)
+						entry.values[1] = v;
+				}
+
+				char buf[256] = "{}\n";
+				if (entry.at <= 0 || entry.action < 0)
+					fprintf(stderr, "Scheduled changes need a time and something to change\n");
+				else
+				{
+					int64_t id = schedule_add(&schedule, &entry);
+					if (id == -2)
+						fprintf(stderr, "Unknown effect %s, nothing scheduled\n", entry.effect);
+					else if (id < 0)
+						fprintf(stderr, "Failed to schedule change, %d are already waiting\n", SCHEDULE_MAX_ENTRIES);
+					else
+					{
+						entry.id = id;
+						printf("Scheduled %s change %u at %lld\n", schedule_action_names[entry.action], entry.id, (long long)entry.at);
+						sprintf(buf + schedule_json(buf, &entry), "\n");
+					}
+				}
+
+				http_reply_ok(&reply, "application/json");
+				http_reply_send(&reply, buf);
+				http_finish(&client, &reply);
+				continue;
+			}
+			else if (strcasecmp(client.method, "DELETE") == 0)
+			{
+				const char* id = NULL;
+				if (client.query != NULL && strncasecmp(client.query, "id=", 3) == 0)
+					id = client.query + 3;
+				else if (client.content_length > 3 && strncasecmp(client.content, "id=", 3) == 0)
+					id = client.content + 3;
+
+				if (id == NULL || schedule_cancel(&schedule, strtoul(id, NULL, 10)) < 0)
+				{
+					http_reply_not_found(&reply);
+					http_finish(&client, &reply);
+					continue;
+				}
+			}
+			else
+			{
+				http_reply_not_implemented(&reply);
+				http_finish(&client, &reply);
+				continue;
+			}
+
+			schedule_entry_t* entries = malloc(SCHEDULE_MAX_ENTRIES * sizeof(schedule_entry_t));
+			char* buf = malloc(SCHEDULE_MAX_ENTRIES * 256 + 16);
+			if (entries == NULL || buf == NULL)
+			{
+				free(entries);
+				free(buf);
+				http_finish(&client, &reply);
+				continue;
+			}
+
+			size_t count = schedule_list(&schedule, entries, SCHEDULE_MAX_ENTRIES);
+			int len = sprintf(buf, "[");
+			for (size_t i = 0; i < count && i < SCHEDULE_MAX_ENTRIES; ++i)
+			{
+				if (i > 0)
+					buf[len++] = ',';
+				len += schedule_json(buf + len, &entries[i]);
+			}
+			sprintf(buf + len, "]\n");
+
+			http_reply_ok(&reply, "application/json");
+			http_reply_send(&reply, buf);
+
+			free(entries);
+			free(buf);
+		}
+		else if (strcmp(client.path, "/light/circadian") == 0)
+		{
+			if (strcasecmp(client.method, "GET") == 0)
+			{
+			}
+			else if (strcasecmp(client.method, "PUT") == 0 || strcasecmp(client.method, "POST") == 0)
+			{
+				if (client.content_length >= 1 || client.query != NULL)
+				{
+					size_t len = client.content_length;
+					char* data = client.content;
+					if (client.content_length < 1)
+					{
+						data = client.query;
+						len = strlen(data);
+					}
+
+					size_t i;
+					for (i = 0; i < len; ++i)
+						if (data[i] == '&' || data[i] == '=')
+							data[i] = 0;
+
+					for (i = 0; i < len;)
+					{
+						char* cur = &(data[i]);
+
+						i += strlen(cur) + 1;
+						if (strcasecmp(cur, "state") == 0)
+						{
+							char* statestr = &data[i];
+							if (strcasecmp(statestr, "on") == 0 || strcmp(statestr, "1") == 0)
+								set_circadian(1);
+							else if (strcasecmp(statestr, "off") == 0 || strcmp(statestr, "0") == 0)
+								set_circadian(0);
+						}
+					}
+				}
+			}
+			else if (strcasecmp(client.method, "DELETE") == 0)
+				set_circadian(0);
+			else
+			{
+				http_reply_not_implemented(&reply);
+				http_finish(&client, &reply);
+				continue;
+			}
+
+			char buf[128];
+			http_reply_ok(&reply, "application/json");
+			sprintf(buf, "{\"state\":%i,\"sunrise\":%lld,\"sunset\":%lld}\n", circadianOn, (long long)circadian.sunrise, (long long)circadian.sunset);
+			http_reply_send(&reply, buf);
+		}
+		else if (strcmp(client.path, "/light/stats") == 0)
+		{
+			if (strcasecmp(client.method, "GET") != 0)
+			{
+				http_reply_not_implemented(&reply);
+				http_finish(&client, &reply);
+				continue;
+			}
+
+			output_stats_t stats;
+			output_get_stats(&output, &stats);
+
+			char buf[1024];
+			int len = sprintf(buf, "{\"submitted\":%lu,\"written\":%lu,\"dropped\":%lu,\"coalesced\":%lu,\"refreshed\":%lu,\"missed\":%lu", stats.submitted, stats.written, stats.dropped, stats.coalesced, stats.refreshed, stats.missed);
+
+			board_latency_t latency;
+			if (board_get_latency(&board, &latency) == 0)
+				len += sprintf(buf + len, ",\"flushes\":%lu,\"flush_last_ns\":%llu,\"flush_max_ns\":%llu,\"flush_avg_ns\":%llu",
+					latency.flushes, (unsigned long long)latency.last_ns, (unsigned long long)latency.max_ns,
+					(unsigned long long)(latency.flushes > 0 ? latency.total_ns / latency.flushes : 0));
+
+			len += sprintf(buf + len, ",\"duration_us\":[");
+			for (int i = 0; i < OUTPUT_HIST_BUCKETS; ++i)
+				len += sprintf(buf + len, "%s%lu", i > 0 ? "," : "", stats.duration_hist[i]);
+			len += sprintf(buf + len, "],\"jitter_us\":[");
+			for (int i = 0; i < OUTPUT_HIST_BUCKETS; ++i)
+				len += sprintf(buf + len, "%s%lu", i > 0 ? "," : "", stats.jitter_hist[i]);
+			sprintf(buf + len, "]}\n");
+
+			http_reply_ok(&reply, "application/json");
+			http_reply_send(&reply, buf);
 		}
 		else
-			http_req_not_found(&client);
+			http_reply_not_found(&reply);
 
-		http_req_close(&client);
+		http_finish(&client, &reply);
 	}
 
 	http_close(&server);
+	free(reply.body);
 
 	return NULL;
 }
@@ -732,6 +1705,8 @@ void publish_callback(void** unused, struct mqtt_response_publish *published)
 
 	printf("Received %zuB publish \"%s\" to %s.\n", published->application_message_size, tmpdata, topic_name);
 
+	pthread_mutex_lock(&state_lock);
+
 	if (strncmp(topic_name, args.mqtt.topic, strlen(args.mqtt.topic)) == 0)
 	{
 		char* subtopic_name = topic_name + strlen(args.mqtt.topic) + 1;
@@ -751,9 +1726,9 @@ void publish_callback(void** unused, struct mqtt_response_publish *published)
 				printf("Changing state from %d to %d\n", lightState, state);
 				lightState = state;
 				if (lightState == LIGHTSTATE_ON)
-					board_write_rgb(&board, &curCol);
+					submit_color(&curCol, curTransition);
 				else
-					board_write_rgb(&board, &offCol);
+					submit_color(&offCol, curTransition);
 			}
 
 			mqtt_publish_state();
@@ -764,12 +1739,12 @@ void publish_callback(void** unused, struct mqtt_response_publish *published)
 			memset(&curHSV, 0, sizeof(curHSV));
 
 			curTemp.k = atoi(tmpdata);
-			curTemp.v = curBright;
-			temperature2rgb(&curTemp, &curCol);
+			curTemp.v = curBright / 65535.f;
+			temperature2rgb16(&curTemp, &curCol);
 
 			print_temp();
 			if (lightState == LIGHTSTATE_ON)
-				board_write_rgb(&board, &curCol);
+				submit_color(&curCol, curTransition);
 
 			mqtt_publish_temperature(0);
 		}
@@ -795,16 +1770,16 @@ void publish_callback(void** unused, struct mqtt_response_publish *published)
 				if (segment == 0)
 					curHSV.h = (uint16_t)atof(cur);
 				else if (segment == 1)
-					curHSV.s = (uint8_t)((atof(cur) / 100.f) * 255);
+					curHSV.s = (uint16_t)((atof(cur) / 100.f) * 65535);
 				segment++;
 			}
 
 			curHSV.v = curBright;
-			hsv2rgb(&curHSV, &curCol);
+			hsv2rgb16(&curHSV, &curCol);
 
 			print_hsv();
 			if (lightState == LIGHTSTATE_ON)
-				board_write_rgb(&board, &curCol);
+				submit_color(&curCol, curTransition);
 
 			mqtt_publish_color(0);
 		}
@@ -813,17 +1788,32 @@ void publish_callback(void** unused, struct mqtt_response_publish *published)
 			memset(&curCol, 0, sizeof(curCol));
 			memset(&curTemp, 0, sizeof(curTemp));
 
-			curBright = (uint8_t)atoi(tmpdata);
+			curBright = COLOR_8TO16((uint8_t)atoi(tmpdata));
 			curHSV.v = curBright;
 
-			hsv2rgb(&curHSV, &curCol);
+			hsv2rgb16(&curHSV, &curCol);
 
 			print_hsv();
 			if (lightState == LIGHTSTATE_ON)
-				board_write_rgb(&board, &curCol);
+				submit_color(&curCol, curTransition);
 
 			mqtt_publish_brightness();
 		}
+		else if (strcmp(subtopic_name, "circadian/set") == 0)
+		{
+			if (strcasecmp(tmpdata, "on") == 0 || strcmp(tmpdata, "1") == 0)
+				set_circadian(1);
+			else if (strcasecmp(tmpdata, "off") == 0 || strcmp(tmpdata, "0") == 0)
+				set_circadian(0);
+		}
+		else if (strcmp(subtopic_name, "effect/set") == 0)
+			set_effect(tmpdata);
+		else if (strcmp(subtopic_name, "transition/set") == 0)
+		{
+			// Seconds, used for every following change made over MQTT
+			curTransition = (uint32_t)(atof(tmpdata) * 1000);
+			printf("New transition: %ums\n", curTransition);
+		}
 		else if (strcmp(subtopic_name, "rgb/set") == 0)
 		{
 			memset(&curHSV, 0, sizeof(curHSV));
@@ -844,26 +1834,28 @@ void publish_callback(void** unused, struct mqtt_response_publish *published)
 
 				i += strlen(cur) + 1;
 				if (segment == 0)
-					curCol.r = (uint8_t)((atoi(cur) / 255.f) * curBright);
+					curCol.r = (uint16_t)(COLOR_8TO16((uint8_t)atoi(cur)) * (uint32_t)curBright / 65535);
 				else if (segment == 1)
-					curCol.g = (uint8_t)((atoi(cur) / 255.f) * curBright);
+					curCol.g = (uint16_t)(COLOR_8TO16((uint8_t)atoi(cur)) * (uint32_t)curBright / 65535);
 				else if (segment == 2)
-					curCol.b = (uint8_t)((atoi(cur) / 255.f) * curBright);
+					curCol.b = (uint16_t)(COLOR_8TO16((uint8_t)atoi(cur)) * (uint32_t)curBright / 65535);
 				segment++;
 			}
 
 			// Store RGB as HSV, to support changing brightness
-			rgb2hsv(&curCol, &curHSV);
+			rgb2hsv16(&curCol, &curHSV);
 			curHSV.v = curBright;
 
 			print_rgb();
 			if (lightState == LIGHTSTATE_ON)
-				board_write_rgb(&board, &curCol);
+				submit_color(&curCol, curTransition);
 
 			mqtt_publish_rgb(0);
 		}
 	}
 
+	pthread_mutex_unlock(&state_lock);
+
 	free(tmpdata);
 	free(topic_name);
 }
@@ -915,13 +1907,23 @@ void reconnect_callback(mqtt_t* unused, void **unused2)
 	mqtt_subscribe(&mqtt, topic, 0);
 	sprintf(topic, "%s/rgb/set", args.mqtt.topic);
 	mqtt_subscribe(&mqtt, topic, 0);
+	sprintf(topic, "%s/transition/set", args.mqtt.topic);
+	mqtt_subscribe(&mqtt, topic, 0);
+	sprintf(topic, "%s/effect/set", args.mqtt.topic);
+	mqtt_subscribe(&mqtt, topic, 0);
+	sprintf(topic, "%s/circadian/set", args.mqtt.topic);
+	mqtt_subscribe(&mqtt, topic, 0);
 
 	if (strlen(args.mqtt.publish) > 0)
 	{
 		snprintf(topic, 128, "%s/light/%s/light/config", args.mqtt.publish, args.mqtt.slug);
 
-		char data[512];
-		int len = snprintf(data, 512, "{"
+		char effects[128] = "\"none\"";
+		for (int i = 0; i < EFFECT_COUNT; ++i)
+			snprintf(effects + strlen(effects), sizeof(effects) - strlen(effects), ",\"%s\"", effect_names[i]);
+
+		char data[768];
+		int len = snprintf(data, 768, "{"
 			"\"name\":\"%s\","
 			"\"~\":\"%s/\","
 			"\"stat_t\":\"~state\","
@@ -932,9 +1934,12 @@ void reconnect_callback(mqtt_t* unused, void **unused2)
 			"\"bri_cmd_t\":\"~brightness/set\","
 			"\"hs_stat_t\":\"~color\","
 			"\"hs_cmd_t\":\"~color/set\","
+			"\"fx_stat_t\":\"~effect\","
+			"\"fx_cmd_t\":\"~effect/set\","
+			"\"fx_list\":[%s],"
 			"\"uniq_id\":\"light_%s\","
 			"\"ret\":true"
-			"}", args.mqtt.name, args.mqtt.topic, args.mqtt.topic);
+			"}", args.mqtt.name, args.mqtt.topic, effects, args.mqtt.topic);
 
 		printf("Publishing %dB of configuration information to %s.\n", len, topic);
 		mqtt_publish(&mqtt, topic, data, len, MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN);
@@ -954,19 +1959,26 @@ void* mqtt_worker(void* unused)
 
 		for (int i = 0; i < MQTT_QUEUELEN; ++i)
 		{
-			if (mqtt_messages[i].ready == 1)
+			// Taken out of the queue first, the other threads keep filling it while this one publishes
+			pthread_mutex_lock(&state_lock);
+			struct mqtt_tosend msg = mqtt_messages[i];
+			if (msg.ready == 1)
 			{
-				printf("Publishing %s to MQTT topic %s\n", mqtt_messages[i].message, mqtt_messages[i].topic);
-				mqtt_publish(&mqtt, mqtt_messages[i].topic, mqtt_messages[i].message, strlen(mqtt_messages[i].message), mqtt_messages[i].flags);
-
-				free(mqtt_messages[i].topic);
-				free(mqtt_messages[i].message);
-
 				mqtt_messages[i].topic = NULL;
 				mqtt_messages[i].message = NULL;
 				mqtt_messages[i].flags = 0;
 				mqtt_messages[i].ready = 0;
 			}
+			pthread_mutex_unlock(&state_lock);
+
+			if (msg.ready == 1)
+			{
+				printf("Publishing %s to MQTT topic %s\n", msg.message, msg.topic);
+				mqtt_publish(&mqtt, msg.topic, msg.message, strlen(msg.message), msg.flags);
+
+				free(msg.topic);
+				free(msg.message);
+			}
 		}
 	}
 
@@ -0,0 +1,650 @@
+#define _GNU_SOURCE
+#include "output.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+static void* output_worker(void*);
+
+// Queued by output_set_effect to stop the running effect
+static effect_t output_no_effect;
+
+static uint64_t output_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int output_init(output_t* output, board_t* board, uint32_t max_fps)
+{
+	memset(output, 0, sizeof(output_t));
+
+	output->board = board;
+	output->pixels = board_pixel_count(board);
+	output->max_fps = max_fps;
+	output->rt_priority = 0;
+	output->cpu = -1;
+	output->fade_fps = OUTPUT_DEFAULT_FADE_FPS;
+	output->timer_fd = -1;
+	if (board->ops->max_fps > 0 && (max_fps == 0 || max_fps > board->ops->max_fps))
+		output->max_fps = board->ops->max_fps;
+	if (output->max_fps > 0 && output->fade_fps > output->max_fps)
+		output->fade_fps = output->max_fps;
+
+	output->last = calloc(output->pixels, sizeof(rgb16_t));
+	if (output->last == NULL)
+		return -1;
+
+	for (int i = 0; i < OUTPUT_SLOTS; ++i)
+	{
+		output->slots[i] = calloc(output->pixels, sizeof(rgb16_t));
+		if (output->slots[i] == NULL)
+			return -1;
+	}
+
+	output->fade_from = calloc(output->pixels, sizeof(rgb16_t));
+	output->fade_to = calloc(output->pixels, sizeof(rgb16_t));
+	if (output->fade_from == NULL || output->fade_to == NULL)
+		return -1;
+
+	if (compose_init(&output->compose, output->pixels) < 0)
+		return -1;
+
+	atomic_init(&output->free_slots, (1U << OUTPUT_SLOTS) - 1);
+	atomic_init(&output->pending, -1);
+	atomic_init(&output->overlay_pending, -1);
+	atomic_init(&output->effect_pending, NULL);
+	atomic_init(&output->running, 0);
+	atomic_init(&output->submitted, 0);
+	atomic_init(&output->written, 0);
+	atomic_init(&output->dropped, 0);
+	atomic_init(&output->coalesced, 0);
+	atomic_init(&output->refreshed, 0);
+	atomic_init(&output->missed, 0);
+	for (int i = 0; i < OUTPUT_HIST_BUCKETS; ++i)
+	{
+		atomic_init(&output->duration_hist[i], 0);
+		atomic_init(&output->jitter_hist[i], 0);
+	}
+
+	output->event_fd = eventfd(0, EFD_CLOEXEC);
+	if (output->event_fd < 0)
+	{
+		int ret = -errno;
+		fprintf(stderr, "Failed to create output event: %s (%d)\n", strerror(-ret), ret);
+		return ret;
+	}
+
+	output->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (output->timer_fd < 0)
+	{
+		int ret = -errno;
+		fprintf(stderr, "Failed to create fade timer: %s (%d)\n", strerror(-ret), ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+int output_set_realtime(output_t* output, int priority, int cpu)
+{
+	if (priority < 0 || priority > sched_get_priority_max(SCHED_FIFO))
+		return -1;
+
+	output->rt_priority = priority;
+	output->cpu = cpu;
+
+	return 0;
+}
+
+int output_set_fade_fps(output_t* output, uint32_t fps)
+{
+	if (fps == 0)
+		return -1;
+
+	// Fades can't step faster than frames may be written
+	if (output->max_fps > 0 && fps > output->max_fps)
+		fps = output->max_fps;
+	output->fade_fps = fps;
+
+	return 0;
+}
+
+int output_start(output_t* output)
+{
+	// Keep page faults out of the write path
+	if (output->rt_priority > 0 && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		fprintf(stderr, "Failed to lock output memory: %s (%d)\n", strerror(errno), -errno);
+
+	atomic_store(&output->running, 1);
+	if (pthread_create(&output->thread, NULL, &output_worker, output))
+	{
+		atomic_store(&output->running, 0);
+		return -1;
+	}
+
+	return 0;
+}
+
+int output_stop(output_t* output)
+{
+	if (atomic_exchange(&output->running, 0) == 0)
+		return 0;
+
+	uint64_t wake = 1;
+	if (write(output->event_fd, &wake, sizeof(wake)) < 0)
+		return -1;
+
+	pthread_join(output->thread, NULL);
+
+	return 0;
+}
+
+void output_cleanup(output_t* output)
+{
+	output_stop(output);
+
+	if (output->event_fd > 0)
+		close(output->event_fd);
+	if (output->timer_fd > 0)
+		close(output->timer_fd);
+	for (int i = 0; i < OUTPUT_SLOTS; ++i)
+		free(output->slots[i]);
+	free(output->last);
+	free(output->fade_from);
+	free(output->fade_to);
+	compose_cleanup(&output->compose);
+	effect_destroy(output->effect);
+	effect_t* pending = atomic_load(&output->effect_pending);
+	if (pending != &output_no_effect)
+		effect_destroy(pending);
+
+	memset(output, 0, sizeof(output_t));
+}
+
+static int output_acquire(output_t* output)
+{
+	unsigned int mask = atomic_load(&output->free_slots);
+	for (;;)
+	{
+		// Only possible with more ingress threads than slots
+		if (mask == 0)
+		{
+			sched_yield();
+			mask = atomic_load(&output->free_slots);
+			continue;
+		}
+
+		int slot = __builtin_ctz(mask);
+		if (atomic_compare_exchange_weak(&output->free_slots, &mask, mask & ~(1U << slot)))
+			return slot;
+	}
+}
+
+static void output_release(output_t* output, int slot)
+{
+	atomic_fetch_or(&output->free_slots, 1U << slot);
+}
+
+static int output_queue_effect(output_t* output, effect_t* effect)
+{
+	// Like frames the latest wins, an effect the output thread hasn't started yet is thrown away
+	effect_t* old = atomic_exchange(&output->effect_pending, effect);
+	if (old != &output_no_effect)
+		effect_destroy(old);
+
+	return 0;
+}
+
+static int output_post(output_t* output, atomic_int* pending, int slot)
+{
+	// Latest wins, a frame the output thread hasn't picked up yet is dropped
+	int old = atomic_exchange(pending, slot);
+	if (old >= 0)
+	{
+		output_release(output, old);
+		atomic_fetch_add(&output->coalesced, 1);
+	}
+	atomic_fetch_add(&output->submitted, 1);
+
+	uint64_t wake = 1;
+	if (write(output->event_fd, &wake, sizeof(wake)) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int output_publish(output_t* output, int slot)
+{
+	// A new colour ends any effect, also one still queued
+	output_queue_effect(output, &output_no_effect);
+
+	return output_post(output, &output->pending, slot);
+}
+
+int output_submit_fade(output_t* output, const rgb16_t* pixels, size_t n, uint32_t ms)
+{
+	if (n > output->pixels)
+		n = output->pixels;
+
+	int slot = output_acquire(output);
+	memcpy(output->slots[slot], pixels, n * sizeof(rgb16_t));
+	// Pixels past the end keep the colour of the last given one
+	for (size_t i = n; i < output->pixels && n > 0; ++i)
+		output->slots[slot][i] = pixels[n - 1];
+	output->fade_ms[slot] = ms;
+
+	return output_publish(output, slot);
+}
+
+int output_submit_rgb_fade(output_t* output, const rgb16_t* rgb, uint32_t ms)
+{
+	int slot = output_acquire(output);
+	for (size_t i = 0; i < output->pixels; ++i)
+		output->slots[slot][i] = *rgb;
+	output->fade_ms[slot] = ms;
+
+	return output_publish(output, slot);
+}
+
+int output_submit(output_t* output, const rgb16_t* pixels, size_t n)
+{
+	return output_submit_fade(output, pixels, n, 0);
+}
+
+int output_submit_rgb(output_t* output, const rgb16_t* rgb)
+{
+	return output_submit_rgb_fade(output, rgb, 0);
+}
+
+int output_submit_overlay_rgb(output_t* output, const rgb16_t* rgb, uint16_t alpha, uint32_t ttl_ms)
+{
+	if (alpha > COLOR_ALPHA_ONE)
+		alpha = COLOR_ALPHA_ONE;
+
+	int slot = output_acquire(output);
+	for (size_t i = 0; i < output->pixels; ++i)
+		output->slots[slot][i] = *rgb;
+	output->overlay_ms[slot] = ttl_ms;
+	output->overlay_alpha[slot] = alpha;
+
+	return output_post(output, &output->overlay_pending, slot);
+}
+
+int output_clear_overlay(output_t* output)
+{
+	rgb16_t none = { 0, 0, 0 };
+	return output_submit_overlay_rgb(output, &none, 0, 0);
+}
+
+int output_set_effect(output_t* output, effect_t* effect)
+{
+	output_queue_effect(output, effect != NULL ? effect : &output_no_effect);
+
+	uint64_t wake = 1;
+	if (write(output->event_fd, &wake, sizeof(wake)) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void output_hist_add(atomic_ulong* hist, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	int bucket = 0;
+	while (us > 1 && bucket < OUTPUT_HIST_BUCKETS - 1)
+	{
+		us >>= 1;
+		++bucket;
+	}
+
+	atomic_fetch_add(&hist[bucket], 1);
+}
+
+static void output_apply_realtime(output_t* output)
+{
+	if (output->cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(output->cpu, &set);
+
+		int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (ret != 0)
+			fprintf(stderr, "Failed to pin output thread to CPU %d: %s (%d)\n", output->cpu, strerror(ret), -ret);
+	}
+
+	if (output->rt_priority > 0)
+	{
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = output->rt_priority;
+
+		int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (ret != 0)
+			fprintf(stderr, "Failed to run output thread as SCHED_FIFO %d: %s (%d)\n", output->rt_priority, strerror(ret), -ret);
+	}
+}
+
+static int output_write(output_t* output, const rgb16_t* frame)
+{
+	uint64_t start = output_now_ns();
+	int ret = board_write_frame16(output->board, frame, output->pixels);
+	if (ret < 0)
+		fprintf(stderr, "Failed to write frame to board\n");
+
+	uint64_t end = output_now_ns();
+	output_hist_add(output->duration_hist, end - start);
+	if (output->last_write_ns > 0)
+	{
+		uint64_t interval = start - output->last_write_ns;
+		if (output->last_interval_ns > 0)
+			output_hist_add(output->jitter_hist, interval > output->last_interval_ns ? interval - output->last_interval_ns : output->last_interval_ns - interval);
+		output->last_interval_ns = interval;
+	}
+	output->last_write_ns = start;
+
+	if (output->max_fps > 0)
+		output->next_write_ns = start + 1000000000ULL / output->max_fps;
+
+	return ret;
+}
+
+static void output_set_timer(output_t* output, uint64_t first_ns, uint64_t period_ns)
+{
+	struct itimerspec spec;
+	spec.it_value.tv_sec = first_ns / 1000000000ULL;
+	spec.it_value.tv_nsec = first_ns % 1000000000ULL;
+	spec.it_interval.tv_sec = period_ns / 1000000000ULL;
+	spec.it_interval.tv_nsec = period_ns % 1000000000ULL;
+
+	if (timerfd_settime(output->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+		fprintf(stderr, "Failed to set fade timer: %s (%d)\n", strerror(errno), -errno);
+}
+
+static void output_fade_start(output_t* output, const rgb16_t* target, uint32_t ms)
+{
+	// Start from whatever shows under the overlay, which is mid-fade or an effect if one is running
+	size_t frame_size = output->pixels * sizeof(rgb16_t);
+	const compose_layer_t* effect = &output->compose.layers[compose_effect];
+	memcpy(output->fade_from, effect->active ? effect->frame : output->compose.layers[compose_base].frame, frame_size);
+	memcpy(output->fade_to, target, frame_size);
+
+	uint64_t period = 1000000000ULL / output->fade_fps;
+	output->fade_start_ns = output_now_ns();
+	output->fade_end_ns = output->fade_start_ns + ms * 1000000ULL;
+	output->fading = 1;
+
+	// The first step is due right away, the rest on a fixed grid from there
+	output_set_timer(output, output->fade_start_ns, period);
+}
+
+static void output_fade_stop(output_t* output)
+{
+	if (!output->fading)
+		return;
+
+	output->fading = 0;
+	output_set_timer(output, 0, 0);
+}
+
+static void output_fade_step(output_t* output, uint64_t now)
+{
+	int64_t t = 65536;
+	if (now < output->fade_end_ns)
+		t = (int64_t)((now - output->fade_start_ns) * 65536 / (output->fade_end_ns - output->fade_start_ns));
+
+	rgb16_t* base = compose_layer(&output->compose, compose_base, COLOR_ALPHA_ONE);
+	for (size_t i = 0; i < output->pixels; ++i)
+	{
+		const rgb16_t* from = &output->fade_from[i];
+		const rgb16_t* to = &output->fade_to[i];
+		base[i].r = from->r + (((to->r - from->r) * t) >> 16);
+		base[i].g = from->g + (((to->g - from->g) * t) >> 16);
+		base[i].b = from->b + (((to->b - from->b) * t) >> 16);
+	}
+
+	if (t >= 65536)
+		output_fade_stop(output);
+}
+
+static void output_effect_stop(output_t* output)
+{
+	if (output->effect == NULL)
+		return;
+
+	effect_destroy(output->effect);
+	output->effect = NULL;
+	compose_clear(&output->compose, compose_effect);
+	// A fade started by the frame that ended the effect keeps the timer
+	if (!output->fading)
+		output_set_timer(output, 0, 0);
+}
+
+static void output_effect_start(output_t* output, effect_t* effect)
+{
+	output_fade_stop(output);
+	output_effect_stop(output);
+
+	output->effect = effect;
+	output->effect_start_ns = output_now_ns();
+	output_set_timer(output, output->effect_start_ns, 1000000000ULL / output->fade_fps);
+}
+
+static void output_effect_step(output_t* output, uint64_t now)
+{
+	// Every pixel shows the same colour, so only one evaluation per tick
+	rgb16_t color;
+	effect_eval(output->effect, (now - output->effect_start_ns) / 1000000ULL, &color);
+
+	// Slow effects hold a colour for several ticks, which leaves the composited frame cached
+	compose_layer_t* layer = &output->compose.layers[compose_effect];
+	if (layer->active && memcmp(&layer->frame[0], &color, sizeof(color)) == 0)
+		return;
+
+	rgb16_t* frame = compose_layer(&output->compose, compose_effect, COLOR_ALPHA_ONE);
+	for (size_t i = 0; i < output->pixels; ++i)
+		frame[i] = color;
+}
+
+static void output_tick(output_t* output)
+{
+	uint64_t expirations;
+	if (read(output->timer_fd, &expirations, sizeof(expirations)) < 0)
+		return;
+
+	// Skipped steps are only counted, the position follows the clock so the fade still ends on time
+	if (expirations > 1)
+		atomic_fetch_add(&output->missed, expirations - 1);
+
+	uint64_t now = output_now_ns();
+	if (output->effect != NULL)
+		output_effect_step(output, now);
+	else if (output->fading)
+		output_fade_step(output, now);
+}
+
+static void output_take_frame(output_t* output)
+{
+	int slot = atomic_exchange(&output->pending, -1);
+	if (slot < 0)
+		return;
+
+	// A new frame always replaces a running fade, either with its own fade or directly
+	const rgb16_t* frame = output->slots[slot];
+	if (output->fade_ms[slot] > 0)
+	{
+		output_fade_start(output, frame, output->fade_ms[slot]);
+		output_release(output, slot);
+		return;
+	}
+	output_fade_stop(output);
+
+	size_t frame_size = output->pixels * sizeof(rgb16_t);
+	if (memcmp(frame, output->compose.layers[compose_base].frame, frame_size) == 0)
+		atomic_fetch_add(&output->dropped, 1);
+	else
+		memcpy(compose_layer(&output->compose, compose_base, COLOR_ALPHA_ONE), frame, frame_size);
+
+	output_release(output, slot);
+}
+
+static void output_take_overlay(output_t* output)
+{
+	int slot = atomic_exchange(&output->overlay_pending, -1);
+	if (slot < 0)
+		return;
+
+	if (output->overlay_ms[slot] == 0)
+		compose_clear(&output->compose, compose_overlay);
+	else
+	{
+		memcpy(compose_layer(&output->compose, compose_overlay, output->overlay_alpha[slot]), output->slots[slot], output->pixels * sizeof(rgb16_t));
+		output->overlay_end_ns = output_now_ns() + output->overlay_ms[slot] * 1000000ULL;
+	}
+
+	output_release(output, slot);
+}
+
+static void output_take_effect(output_t* output)
+{
+	effect_t* effect = atomic_exchange(&output->effect_pending, NULL);
+	if (effect == NULL)
+		return;
+
+	if (effect == &output_no_effect)
+		output_effect_stop(output);
+	else
+		output_effect_start(output, effect);
+}
+
+// Writes the composited layers if they differ from what the board shows, returns 1 if written
+static int output_present(output_t* output)
+{
+	const rgb16_t* frame = compose_frame(&output->compose);
+	size_t frame_size = output->pixels * sizeof(rgb16_t);
+	if (output->has_last && memcmp(frame, output->last, frame_size) == 0)
+		return 0;
+
+	int ret = output_write(output, frame);
+	if (ret < 0)
+		return 0;
+
+	memcpy(output->last, frame, frame_size);
+	output->has_last = 1;
+	output->unsettled = ret > 0;
+	atomic_fetch_add(&output->written, 1);
+
+	return 1;
+}
+
+static void* output_worker(void* data)
+{
+	output_t* output = (output_t*)data;
+
+	output_apply_realtime(output);
+
+	struct pollfd pfd[2];
+	pfd[0].fd = output->event_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = output->timer_fd;
+	pfd[1].events = POLLIN;
+
+	while (atomic_load(&output->running))
+	{
+		// While the board is still dithering a still frame, wake up for the next step of it
+		uint64_t deadline = UINT64_MAX;
+		if (output->unsettled && !output->fading && output->effect == NULL)
+		{
+			deadline = output->next_write_ns;
+			if (output->max_fps == 0)
+				deadline = output->last_write_ns + 1000000000ULL / OUTPUT_DEFAULT_MAX_FPS;
+		}
+		// And for the overlay to run out
+		if (output->compose.layers[compose_overlay].active && output->overlay_end_ns < deadline)
+			deadline = output->overlay_end_ns;
+
+		struct timespec timeout, *wait = NULL;
+		if (deadline != UINT64_MAX)
+		{
+			uint64_t now = output_now_ns();
+			uint64_t left = deadline > now ? deadline - now : 0;
+			timeout.tv_sec = left / 1000000000ULL;
+			timeout.tv_nsec = left % 1000000000ULL;
+			wait = &timeout;
+		}
+
+		int ret = ppoll(pfd, 2, wait, NULL);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "Output thread failed to wait for frames: %s (%d)\n", strerror(errno), -errno);
+			break;
+		}
+
+		if (ret > 0 && (pfd[1].revents & POLLIN))
+			output_tick(output);
+
+		uint64_t events;
+		if (ret > 0 && (pfd[0].revents & POLLIN) && read(output->event_fd, &events, sizeof(events)) >= 0)
+		{
+			// Hold off until the frame rate cap allows another write, newer frames replace this one meanwhile
+			if (output->max_fps > 0 && output_now_ns() < output->next_write_ns)
+			{
+				struct timespec until;
+				until.tv_sec = output->next_write_ns / 1000000000ULL;
+				until.tv_nsec = output->next_write_ns % 1000000000ULL;
+				while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+					;
+			}
+
+			// Frames first, publishing one also queues the end of any effect, so a later effect still wins
+			output_take_frame(output);
+			output_take_overlay(output);
+			output_take_effect(output);
+		}
+
+		if (output->compose.layers[compose_overlay].active && output_now_ns() >= output->overlay_end_ns)
+			compose_clear(&output->compose, compose_overlay);
+
+		// Only a timeout with nothing new to show steps the dithering of the frame on the board
+		if (output_present(output) || ret > 0 || !output->unsettled)
+			continue;
+
+		ret = output_write(output, output->last);
+		output->unsettled = ret > 0;
+		if (ret >= 0)
+			atomic_fetch_add(&output->refreshed, 1);
+	}
+
+	return NULL;
+}
+
+void output_get_stats(const output_t* output, output_stats_t* stats)
+{
+	stats->submitted = atomic_load(&output->submitted);
+	stats->written = atomic_load(&output->written);
+	stats->dropped = atomic_load(&output->dropped);
+	stats->coalesced = atomic_load(&output->coalesced);
+	stats->refreshed = atomic_load(&output->refreshed);
+	stats->missed = atomic_load(&output->missed);
+
+	for (int i = 0; i < OUTPUT_HIST_BUCKETS; ++i)
+	{
+		stats->duration_hist[i] = atomic_load(&output->duration_hist[i]);
+		stats->jitter_hist[i] = atomic_load(&output->jitter_hist[i]);
+	}
+}
@@ -0,0 +1,123 @@
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include "board.h"
+#include "color.h"
+#include "compose.h"
+#include "effect.h"
+
+// One pending frame, one being written and one per ingress thread being filled
+#define OUTPUT_SLOTS 8
+
+#define OUTPUT_DEFAULT_MAX_FPS 60
+#define OUTPUT_DEFAULT_FADE_FPS 50
+
+// Power-of-two microsecond buckets, the first holds everything below 2us and the last everything from 32.768ms up
+#define OUTPUT_HIST_BUCKETS 16
+
+struct _output_stats_t
+{
+	unsigned long submitted;
+	unsigned long written;
+	// Identical to what is already on the bus
+	unsigned long dropped;
+	// Replaced by a newer frame before it was written
+	unsigned long coalesced;
+	// Written again without a new frame, to step the dithering
+	unsigned long refreshed;
+	// Fade steps that came due while the output thread was still busy
+	unsigned long missed;
+
+	// Time spent writing a frame, and change in time between consecutive writes
+	unsigned long duration_hist[OUTPUT_HIST_BUCKETS];
+	unsigned long jitter_hist[OUTPUT_HIST_BUCKETS];
+};
+typedef struct _output_stats_t output_stats_t;
+
+struct _output_t
+{
+	board_t* board;
+	size_t pixels;
+
+	// Frames stay 16-bit until the board quantises them
+	rgb16_t* slots[OUTPUT_SLOTS];
+	// Milliseconds to fade into each slot over, written by the thread holding it
+	uint32_t fade_ms[OUTPUT_SLOTS];
+	// For slots submitted as overlays instead, how long and how opaque to show them
+	uint32_t overlay_ms[OUTPUT_SLOTS];
+	uint16_t overlay_alpha[OUTPUT_SLOTS];
+
+	// Owned by the output thread, frames go to the base layer, effects and overlays above it
+	compose_t compose;
+	uint64_t overlay_end_ns;
+
+	// Owned by the output thread, the composited frame the board is currently showing
+	rgb16_t* last;
+	int has_last;
+	// The board reported a dither residual for last, keep rewriting it
+	int unsettled;
+
+	uint32_t max_fps;
+	uint64_t next_write_ns;
+
+	// Owned by the output thread, the fade in progress
+	uint32_t fade_fps;
+	int fading;
+	uint64_t fade_start_ns, fade_end_ns;
+	rgb16_t *fade_from, *fade_to;
+
+	// Owned by the output thread, the effect stepped on the fade timer instead of a fade
+	effect_t* effect;
+	uint64_t effect_start_ns;
+	// Handed over by output_set_effect, taken on the next wakeup
+	_Atomic(effect_t*) effect_pending;
+
+	atomic_ulong submitted, written, dropped, coalesced, refreshed, missed;
+
+	// SCHED_FIFO priority, 0 for normal scheduling, and CPU to pin to, -1 for any
+	int rt_priority;
+	int cpu;
+
+	uint64_t last_write_ns, last_interval_ns;
+	atomic_ulong duration_hist[OUTPUT_HIST_BUCKETS];
+	atomic_ulong jitter_hist[OUTPUT_HIST_BUCKETS];
+
+	// Bit set for every slot no thread holds
+	atomic_uint free_slots;
+	// Latest submitted slot, -1 when the output has caught up
+	atomic_int pending;
+	atomic_int overlay_pending;
+
+	int event_fd;
+	// Absolute CLOCK_MONOTONIC deadlines for fade steps
+	int timer_fd;
+	atomic_int running;
+	pthread_t thread;
+};
+typedef struct _output_t output_t;
+
+int output_init(output_t*, board_t*, uint32_t max_fps);
+int output_set_realtime(output_t*, int priority, int cpu);
+int output_set_fade_fps(output_t*, uint32_t fps);
+int output_start(output_t*);
+int output_stop(output_t*);
+void output_cleanup(output_t*);
+
+int output_submit(output_t*, const rgb16_t* pixels, size_t n);
+int output_submit_rgb(output_t*, const rgb16_t*);
+// Fade from what is shown to the given frame over ms milliseconds, 0 to switch at once
+int output_submit_fade(output_t*, const rgb16_t* pixels, size_t n, uint32_t ms);
+int output_submit_rgb_fade(output_t*, const rgb16_t*, uint32_t ms);
+// Shows a colour over the frames and effects for ttl_ms, alpha is 0..COLOR_ALPHA_ONE.
+// The next overlay replaces it, the layers below keep running meanwhile.
+int output_submit_overlay_rgb(output_t*, const rgb16_t*, uint16_t alpha, uint32_t ttl_ms);
+int output_clear_overlay(output_t*);
+// Takes ownership of the effect and runs it until the next frame, NULL stops it
+int output_set_effect(output_t*, effect_t*);
+
+void output_get_stats(const output_t*, output_stats_t*);
+
+#endif
@@ -0,0 +1,446 @@
+#include "schedule.h"
+#include "effect.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+const char* const schedule_action_names[schedule_action_count] = { "state", "rgb", "hsv", "temperature", "effect" };
+
+static void* schedule_worker(void*);
+
+// Effect names are taken in the effect table's spelling, "none" included, anything else is refused up front
+static const char* schedule_effect_name(const char* name)
+{
+	if (strcasecmp(name, "none") == 0)
+		return "none";
+	return effect_lookup(name);
+}
+
+static void schedule_link(schedule_entry_t** head, schedule_entry_t* entry)
+{
+	entry->pprev = head;
+	entry->next = *head;
+	if (*head != NULL)
+		(*head)->pprev = &entry->next;
+	*head = entry;
+}
+
+static void schedule_unlink(schedule_entry_t* entry)
+{
+	*entry->pprev = entry->next;
+	if (entry->next != NULL)
+		entry->next->pprev = entry->pprev;
+}
+
+static void schedule_place(schedule_t* schedule, schedule_entry_t* entry)
+{
+	// Overdue entries go in the slot that runs next
+	int64_t at = entry->at < schedule->now ? schedule->now : entry->at;
+	int64_t delta = at - schedule->now;
+	if (delta >= SCHEDULE_RANGE)
+		at = schedule->now + SCHEDULE_RANGE - 1;
+
+	int level = 0;
+	while (level < SCHEDULE_LEVELS - 1 && delta >= (1LL << (SCHEDULE_SLOT_BITS * (level + 1))))
+		++level;
+
+	int slot = (at >> (SCHEDULE_SLOT_BITS * level)) & (SCHEDULE_SLOTS - 1);
+	schedule_link(&schedule->wheel[level][slot], entry);
+}
+
+static int64_t schedule_clock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec;
+}
+
+static int schedule_save(const schedule_t* schedule)
+{
+	if (schedule->path == NULL)
+		return 0;
+
+	// Replaced in one go, a crash mid-write leaves the previous file
+	char tmp[512];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", schedule->path);
+
+	FILE* file = fopen(tmp, "w");
+	if (file == NULL)
+	{
+		int ret = -errno;
+		fprintf(stderr, "Failed to save schedule to %s: %s (%d)\n", tmp, strerror(-ret), ret);
+		return ret;
+	}
+
+	fprintf(file, "# id at every transition_ms action v0 v1 v2 effect\n");
+	for (size_t i = 0; i < SCHEDULE_MAX_ENTRIES; ++i)
+	{
+		const schedule_entry_t* entry = &schedule->entries[i];
+		if (!entry->used)
+			continue;
+
+		fprintf(file, "%u %lld %u %u %s %g %g %g %s\n", entry->id, (long long)entry->at, entry->every, entry->transition_ms,
+			schedule_action_names[entry->action], entry->values[0], entry->values[1], entry->values[2],
+			entry->effect[0] != 0 ? entry->effect : "-");
+	}
+
+	if (fclose(file) != 0 || rename(tmp, schedule->path) < 0)
+	{
+		int ret = -errno;
+		fprintf(stderr, "Failed to save schedule to %s: %s (%d)\n", schedule->path, strerror(-ret), ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int schedule_load(schedule_t* schedule)
+{
+	FILE* file = fopen(schedule->path, "r");
+	if (file == NULL)
+	{
+		// Nothing scheduled yet
+		if (errno == ENOENT)
+			return 0;
+
+		int ret = -errno;
+		fprintf(stderr, "Failed to load schedule from %s: %s (%d)\n", schedule->path, strerror(-ret), ret);
+		return ret;
+	}
+
+	char line[256];
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		schedule_entry_t entry;
+		memset(&entry, 0, sizeof(entry));
+
+		long long at;
+		char action[16];
+		if (sscanf(line, "%u %lld %u %u %15s %g %g %g %15s", &entry.id, &at, &entry.every, &entry.transition_ms,
+				action, &entry.values[0], &entry.values[1], &entry.values[2], entry.effect) != 9)
+		{
+			fprintf(stderr, "Skipping malformed schedule line: %s", line);
+			continue;
+		}
+		entry.at = at;
+		if (strcmp(entry.effect, "-") == 0)
+			entry.effect[0] = 0;
+
+		entry.action = -1;
+		for (int i = 0; i < schedule_action_count; ++i)
+			if (strcmp(action, schedule_action_names[i]) == 0)
+				entry.action = i;
+
+		const char* effect = schedule_effect_name(entry.effect);
+		if (entry.action == schedule_effect && effect == NULL)
+			entry.action = -1;
+		else if (effect != NULL)
+			strcpy(entry.effect, effect);
+
+		schedule_entry_t* slot = &schedule->entries[entry.id & (SCHEDULE_MAX_ENTRIES - 1)];
+		if (entry.action < 0 || slot->used)
+		{
+			fprintf(stderr, "Skipping schedule entry %u\n", entry.id);
+			continue;
+		}
+
+		*slot = entry;
+		slot->used = 1;
+		schedule->count++;
+	}
+
+	fclose(file);
+	return 0;
+}
+
+int schedule_init(schedule_t* schedule, const char* path, schedule_fire_t fire, schedule_tick_t tick, void* data)
+{
+	memset(schedule, 0, sizeof(schedule_t));
+
+	schedule->path = path;
+	schedule->fire = fire;
+	schedule->tick = tick;
+	schedule->data = data;
+	schedule->now = schedule_clock();
+	atomic_init(&schedule->running, 0);
+
+	schedule->entries = calloc(SCHEDULE_MAX_ENTRIES, sizeof(schedule_entry_t));
+	schedule->due = calloc(SCHEDULE_MAX_ENTRIES, sizeof(schedule_entry_t));
+	if (schedule->entries == NULL || schedule->due == NULL)
+		return -1;
+
+	if (pthread_mutex_init(&schedule->lock, NULL) != 0)
+		return -1;
+
+	if (path != NULL)
+	{
+		int ret = schedule_load(schedule);
+		if (ret < 0)
+			return ret;
+	}
+
+	// Walked backwards so the lowest indices are handed out first
+	for (size_t i = SCHEDULE_MAX_ENTRIES; i-- > 0;)
+	{
+		schedule_entry_t* entry = &schedule->entries[i];
+		if (!entry->used)
+		{
+			entry->next = schedule->free_list;
+			schedule->free_list = entry;
+			continue;
+		}
+
+		// Repeats missed while stopped are skipped, only the next one runs
+		if (entry->every > 0)
+			while (entry->at < schedule->now)
+				entry->at += entry->every;
+		schedule_place(schedule, entry);
+	}
+
+	return 0;
+}
+
+int schedule_start(schedule_t* schedule)
+{
+	atomic_store(&schedule->running, 1);
+	if (pthread_create(&schedule->thread, NULL, &schedule_worker, schedule))
+	{
+		atomic_store(&schedule->running, 0);
+		return -1;
+	}
+
+	return 0;
+}
+
+int schedule_stop(schedule_t* schedule)
+{
+	if (atomic_exchange(&schedule->running, 0) == 0)
+		return 0;
+
+	// The worker checks in every second
+	pthread_join(schedule->thread, NULL);
+
+	return 0;
+}
+
+void schedule_cleanup(schedule_t* schedule)
+{
+	schedule_stop(schedule);
+
+	// Whatever changed since the last tick
+	if (schedule->dirty)
+		schedule_save(schedule);
+
+	if (schedule->entries != NULL)
+		pthread_mutex_destroy(&schedule->lock);
+	free(schedule->entries);
+	free(schedule->due);
+
+	memset(schedule, 0, sizeof(schedule_t));
+}
+
+int64_t schedule_add(schedule_t* schedule, const schedule_entry_t* entry)
+{
+	if (entry->action < 0 || entry->action >= schedule_action_count)
+		return -2;
+
+	const char* effect = NULL;
+	if (entry->action == schedule_effect && (effect = schedule_effect_name(entry->effect)) == NULL)
+		return -2;
+
+	pthread_mutex_lock(&schedule->lock);
+
+	schedule_entry_t* slot = schedule->free_list;
+	if (slot == NULL)
+	{
+		pthread_mutex_unlock(&schedule->lock);
+		return -1;
+	}
+	schedule->free_list = slot->next;
+
+	// The generation above the index tells a reused slot apart from the entry it held before
+	uint32_t generation = (slot->id / SCHEDULE_MAX_ENTRIES + 1) & (UINT32_MAX / SCHEDULE_MAX_ENTRIES);
+	if (generation == 0)
+		generation = 1;
+	uint32_t id = generation * SCHEDULE_MAX_ENTRIES + (uint32_t)(slot - schedule->entries);
+
+	*slot = *entry;
+	slot->id = id;
+	slot->used = 1;
+	slot->effect[sizeof(slot->effect) - 1] = 0;
+	if (effect != NULL)
+		strcpy(slot->effect, effect);
+	schedule->count++;
+	schedule_place(schedule, slot);
+
+	schedule->dirty = 1;
+	pthread_mutex_unlock(&schedule->lock);
+
+	return id;
+}
+
+int schedule_cancel(schedule_t* schedule, uint32_t id)
+{
+	pthread_mutex_lock(&schedule->lock);
+
+	schedule_entry_t* entry = &schedule->entries[id & (SCHEDULE_MAX_ENTRIES - 1)];
+	if (!entry->used || entry->id != id)
+	{
+		pthread_mutex_unlock(&schedule->lock);
+		return -1;
+	}
+
+	schedule_unlink(entry);
+	entry->used = 0;
+	entry->next = schedule->free_list;
+	schedule->free_list = entry;
+	schedule->count--;
+
+	schedule->dirty = 1;
+	pthread_mutex_unlock(&schedule->lock);
+
+	return 0;
+}
+
+size_t schedule_list(schedule_t* schedule, schedule_entry_t* out, size_t max)
+{
+	pthread_mutex_lock(&schedule->lock);
+
+	size_t n = 0;
+	for (size_t i = 0; i < SCHEDULE_MAX_ENTRIES && n < max; ++i)
+		if (schedule->entries[i].used)
+			out[n++] = schedule->entries[i];
+
+	size_t count = schedule->count;
+	pthread_mutex_unlock(&schedule->lock);
+
+	return count;
+}
+
+// Moves every entry of a slot to the level below, now that it is close enough
+static void schedule_cascade(schedule_t* schedule, int level, int slot)
+{
+	schedule_entry_t* entry = schedule->wheel[level][slot];
+	schedule->wheel[level][slot] = NULL;
+
+	while (entry != NULL)
+	{
+		schedule_entry_t* next = entry->next;
+		schedule_place(schedule, entry);
+		entry = next;
+	}
+}
+
+static int schedule_tick(schedule_t* schedule)
+{
+	int64_t t = schedule->now;
+
+	for (int level = SCHEDULE_LEVELS - 1; level > 0; --level)
+	{
+		int64_t mask = (1LL << (SCHEDULE_SLOT_BITS * level)) - 1;
+		if ((t & mask) == 0)
+			schedule_cascade(schedule, level, (t >> (SCHEDULE_SLOT_BITS * level)) & (SCHEDULE_SLOTS - 1));
+	}
+
+	int slot = t & (SCHEDULE_SLOTS - 1);
+	schedule_entry_t* entry = schedule->wheel[0][slot];
+	schedule->wheel[0][slot] = NULL;
+	schedule->now = t + 1;
+
+	int fired = 0;
+	while (entry != NULL)
+	{
+		schedule_entry_t* next = entry->next;
+
+		// A second holds at most every entry once, so this never overflows
+		schedule->due[schedule->due_count++] = *entry;
+		fired = 1;
+
+		if (entry->every > 0)
+		{
+			while (entry->at <= t)
+				entry->at += entry->every;
+			schedule_place(schedule, entry);
+		}
+		else
+		{
+			entry->used = 0;
+			entry->next = schedule->free_list;
+			schedule->free_list = entry;
+			schedule->count--;
+		}
+
+		entry = next;
+	}
+
+	return fired;
+}
+
+void schedule_advance(schedule_t* schedule, int64_t now)
+{
+	pthread_mutex_lock(&schedule->lock);
+
+	// After a large clock step, e.g. the first NTP sync after boot, place everything again instead of walking every second
+	if (now - schedule->now >= SCHEDULE_RANGE)
+	{
+		memset(schedule->wheel, 0, sizeof(schedule->wheel));
+		schedule->now = now;
+		for (size_t i = 0; i < SCHEDULE_MAX_ENTRIES; ++i)
+			if (schedule->entries[i].used)
+				schedule_place(schedule, &schedule->entries[i]);
+	}
+
+	int fired = 0;
+	while (schedule->now <= now)
+	{
+		fired |= schedule_tick(schedule);
+		if (schedule->due_count == 0)
+			continue;
+
+		// The callbacks take their own locks, and may add or cancel entries themselves
+		size_t count = schedule->due_count;
+		schedule->due_count = 0;
+		pthread_mutex_unlock(&schedule->lock);
+		for (size_t i = 0; i < count; ++i)
+			schedule->fire(&schedule->due[i], schedule->data);
+		pthread_mutex_lock(&schedule->lock);
+	}
+
+	// Changes are written out at most once a second, however many came in
+	if (fired || schedule->dirty)
+	{
+		schedule_save(schedule);
+		schedule->dirty = 0;
+	}
+
+	pthread_mutex_unlock(&schedule->lock);
+}
+
+static void* schedule_worker(void* data)
+{
+	schedule_t* schedule = (schedule_t*)data;
+
+	while (atomic_load(&schedule->running))
+	{
+		// Wake up right as each wall clock second starts
+		struct timespec until;
+		until.tv_sec = schedule_clock() + 1;
+		until.tv_nsec = 0;
+		while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &until, NULL) == EINTR)
+			;
+
+		int64_t now = schedule_clock();
+		schedule_advance(schedule, now);
+		if (schedule->tick != NULL)
+			schedule->tick(now, schedule->data);
+	}
+
+	return NULL;
+}
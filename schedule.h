@@ -0,0 +1,102 @@
+#ifndef _SCHEDULE_H
+#define _SCHEDULE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Four levels of 64 one-second slots reach about 194 days ahead, entries
+// further out wait in the last slot and are placed again when it comes up
+#define SCHEDULE_SLOT_BITS 6
+#define SCHEDULE_SLOTS (1 << SCHEDULE_SLOT_BITS)
+#define SCHEDULE_LEVELS 4
+#define SCHEDULE_RANGE (1LL << (SCHEDULE_SLOT_BITS * SCHEDULE_LEVELS))
+
+// Power of two, the low bits of an id are its index in the pool
+#define SCHEDULE_MAX_ENTRIES 4096
+
+enum schedule_action_t
+{
+	schedule_state = 0,
+	schedule_rgb,
+	schedule_hsv,
+	schedule_temperature,
+	schedule_effect,
+
+	schedule_action_count
+};
+extern const char* const schedule_action_names[];
+
+struct _schedule_entry_t
+{
+	uint32_t id;
+	// Wall clock seconds, and seconds until it runs again, 0 to only run once
+	int64_t at;
+	uint32_t every;
+
+	int action;
+	// In the units of the matching HTTP endpoint, state is 0 or 1 in values[0]
+	float values[3];
+	char effect[16];
+	uint32_t transition_ms;
+
+	// Slot list the entry waits in, pprev points at whatever points at the entry so it unlinks in O(1)
+	struct _schedule_entry_t *next, **pprev;
+	int used;
+};
+typedef struct _schedule_entry_t schedule_entry_t;
+
+// Called from the schedule thread with a copy of the entry, the schedule is not locked so it may add or cancel entries
+typedef void (*schedule_fire_t)(const schedule_entry_t*, void*);
+// Called from the schedule thread every second, after anything due has fired
+typedef void (*schedule_tick_t)(int64_t now, void*);
+
+struct _schedule_t
+{
+	pthread_mutex_t lock;
+
+	schedule_entry_t* entries;
+	schedule_entry_t* free_list;
+	size_t count;
+
+	// Entries that came due in the current second, fired once the lock is dropped
+	schedule_entry_t* due;
+	size_t due_count;
+
+	schedule_entry_t* wheel[SCHEDULE_LEVELS][SCHEDULE_SLOTS];
+	// Next second to run, everything before it has fired
+	int64_t now;
+
+	// File the entries are kept in across restarts, NULL to only keep them in memory
+	const char* path;
+	// Entries were added or cancelled since the file was last written
+	int dirty;
+
+	schedule_fire_t fire;
+	schedule_tick_t tick;
+	void* data;
+
+	atomic_int running;
+	pthread_t thread;
+};
+typedef struct _schedule_t schedule_t;
+
+// Loads any entries kept in path, the ones a restart missed fire on the first tick
+// The tick callback may be NULL
+int schedule_init(schedule_t*, const char* path, schedule_fire_t, schedule_tick_t, void* data);
+int schedule_start(schedule_t*);
+int schedule_stop(schedule_t*);
+void schedule_cleanup(schedule_t*);
+
+// Adding and cancelling only mark the file as changed, the schedule thread writes it on its next tick
+// Copies the entry in and returns its new id, -1 when full or -2 for an unknown action or effect
+int64_t schedule_add(schedule_t*, const schedule_entry_t*);
+int schedule_cancel(schedule_t*, uint32_t id);
+// Copies up to max entries out in pool order, returns how many there are in total
+size_t schedule_list(schedule_t*, schedule_entry_t* out, size_t max);
+
+// Fires everything due up to and including the given second
+void schedule_advance(schedule_t*, int64_t now);
+
+#endif
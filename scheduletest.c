@@ -0,0 +1,319 @@
+// Drives the timer wheel through schedule_advance() on a made up wall clock, defining
+// clock_gettime() here puts it in front of the C library for schedule.o
+#include "schedule.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+#define FIRED_MAX 64
+
+// Not on any level boundary, so every level cascades at a different second
+#define T0 1700000123LL
+
+static int64_t fake_now;
+
+int clock_gettime(clockid_t clock, struct timespec* ts)
+{
+	if (clock != CLOCK_REALTIME)
+		return syscall(SYS_clock_gettime, clock, ts);
+
+	ts->tv_sec = fake_now;
+	ts->tv_nsec = 0;
+	return 0;
+}
+
+struct fired_t
+{
+	uint32_t id;
+	// The second it was placed for, and the one it actually fired in
+	int64_t at, second;
+};
+
+static struct fired_t fired[FIRED_MAX];
+static size_t fired_count;
+
+static void record_fire(const schedule_entry_t* entry, void* data)
+{
+	const schedule_t* schedule = (const schedule_t*)data;
+
+	// The tick has moved on to the next second by the time anything fires
+	if (fired_count < FIRED_MAX)
+	{
+		fired[fired_count].id = entry->id;
+		fired[fired_count].at = entry->at;
+		fired[fired_count].second = schedule->now - 1;
+	}
+	fired_count++;
+}
+
+static int start(schedule_t* schedule, const char* path, int64_t now)
+{
+	fake_now = now;
+	fired_count = 0;
+	if (schedule_init(schedule, path, record_fire, NULL, schedule) < 0)
+	{
+		fprintf(stderr, "Failed to set up the schedule\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int64_t add(schedule_t* schedule, int64_t at, uint32_t every)
+{
+	schedule_entry_t entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.at = at;
+	entry.every = every;
+	entry.action = schedule_state;
+
+	return schedule_add(schedule, &entry);
+}
+
+static void advance(schedule_t* schedule, int64_t now)
+{
+	fake_now = now;
+	schedule_advance(schedule, now);
+}
+
+// Entries have to have fired in this order and in these seconds, and nothing else may have
+static int expect(const char* name, const uint32_t* ids, const int64_t* seconds, size_t n)
+{
+	if (fired_count != n)
+	{
+		fprintf(stderr, "%s: %zu entries fired instead of %zu\n", name, fired_count, n);
+		return 1;
+	}
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (fired[i].id != ids[i] || fired[i].second != seconds[i])
+		{
+			fprintf(stderr, "%s: firing %zu was %u at T0%+lld instead of %u at T0%+lld\n", name, i,
+				fired[i].id, (long long)(fired[i].second - T0), ids[i], (long long)(seconds[i] - T0));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int check_cascade()
+{
+	// Either side of every level boundary, and past the end of the wheel
+	static const int64_t offsets[] = { 1, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, 262145,
+		SCHEDULE_RANGE - 1, SCHEDULE_RANGE, SCHEDULE_RANGE + 5000, 3 * SCHEDULE_RANGE + 7 };
+	const size_t n = sizeof(offsets) / sizeof(offsets[0]);
+
+	int ret = 0;
+	// Once with the clock off every level boundary, once on all of them
+	static const int64_t starts[] = { T0, T0 & ~(SCHEDULE_RANGE - 1) };
+	for (size_t s = 0; s < 2 && ret == 0; ++s)
+	{
+		int64_t t0 = starts[s];
+		schedule_t schedule;
+		if (start(&schedule, NULL, t0) < 0)
+			return 1;
+
+		uint32_t ids[sizeof(offsets) / sizeof(offsets[0])];
+		int64_t seconds[sizeof(offsets) / sizeof(offsets[0])];
+		for (size_t i = 0; i < n; ++i)
+		{
+			ids[i] = add(&schedule, t0 + offsets[i], 0);
+			seconds[i] = t0 + offsets[i];
+		}
+
+		// Walked in steps below the range, so every second is ticked through
+		for (int64_t now = t0; now < t0 + offsets[n - 1]; now += SCHEDULE_RANGE / 2)
+			advance(&schedule, now);
+		advance(&schedule, t0 + offsets[n - 1]);
+
+		ret = expect("cascade", ids, seconds, n);
+		if (ret == 0 && schedule.count != 0)
+		{
+			fprintf(stderr, "cascade: %zu one-shot entries are still waiting\n", schedule.count);
+			ret = 1;
+		}
+		schedule_cleanup(&schedule);
+	}
+
+	return ret;
+}
+
+static int check_repeat()
+{
+	schedule_t schedule;
+	if (start(&schedule, NULL, T0) < 0)
+		return 1;
+
+	uint32_t id = add(&schedule, T0 + 5, 10);
+	advance(&schedule, T0 + 100);
+
+	uint32_t ids[10];
+	int64_t seconds[10];
+	for (int i = 0; i < 10; ++i)
+	{
+		ids[i] = id;
+		seconds[i] = T0 + 5 + 10 * i;
+	}
+
+	int ret = expect("repeat", ids, seconds, 10);
+	if (ret == 0 && schedule.count != 1)
+	{
+		fprintf(stderr, "repeat: the entry is gone after firing\n");
+		ret = 1;
+	}
+
+	schedule_cleanup(&schedule);
+	return ret;
+}
+
+static int check_reused_id()
+{
+	schedule_t schedule;
+	if (start(&schedule, NULL, T0) < 0)
+		return 1;
+
+	int ret = 0;
+	int64_t first = add(&schedule, T0 + 10, 0);
+	schedule_cancel(&schedule, first);
+
+	// Lands in the slot just freed, under a new id
+	int64_t second = add(&schedule, T0 + 20, 0);
+	if (first < 0 || second < 0 || second == first
+		|| (first & (SCHEDULE_MAX_ENTRIES - 1)) != (second & (SCHEDULE_MAX_ENTRIES - 1)))
+	{
+		fprintf(stderr, "reused_id: got ids %lld and %lld for the same slot\n", (long long)first, (long long)second);
+		ret = 1;
+	}
+	else if (schedule_cancel(&schedule, first) == 0)
+	{
+		fprintf(stderr, "reused_id: the stale id %lld cancelled the entry that took its slot\n", (long long)first);
+		ret = 1;
+	}
+	else
+	{
+		advance(&schedule, T0 + 30);
+		uint32_t ids[] = { second };
+		int64_t seconds[] = { T0 + 20 };
+		ret = expect("reused_id", ids, seconds, 1);
+	}
+
+	schedule_cleanup(&schedule);
+	return ret;
+}
+
+static int check_restart()
+{
+	char path[] = "/tmp/scheduletest.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		perror("Failed to create a schedule file");
+		return 1;
+	}
+	close(fd);
+
+	schedule_t schedule;
+	if (start(&schedule, path, T0) < 0)
+	{
+		unlink(path);
+		return 1;
+	}
+
+	int64_t once = add(&schedule, T0 + 10, 0);
+	int64_t repeat = add(&schedule, T0 + 3, 7);
+	int64_t later = add(&schedule, T0 + 1000, 0);
+	advance(&schedule, T0 + 5);
+	schedule_cleanup(&schedule);
+
+	// Back a second after the repeat was last due at T0+94, the missed one-shot fires right away
+	// and the missed repeats are skipped
+	int ret = 1;
+	if (start(&schedule, path, T0 + 95) == 0)
+	{
+		if (schedule.count != 3)
+			fprintf(stderr, "restart: %zu of 3 entries came back\n", schedule.count);
+		else
+		{
+			advance(&schedule, T0 + 95);
+			advance(&schedule, T0 + 110);
+			schedule_cancel(&schedule, repeat);
+			advance(&schedule, T0 + 1000);
+
+			uint32_t ids[] = { once, repeat, repeat, later };
+			int64_t seconds[] = { T0 + 95, T0 + 101, T0 + 108, T0 + 1000 };
+			ret = expect("restart", ids, seconds, 4);
+		}
+		schedule_cleanup(&schedule);
+	}
+
+	unlink(path);
+	return ret;
+}
+
+static int check_clock_step()
+{
+	schedule_t schedule;
+	if (start(&schedule, NULL, T0) < 0)
+		return 1;
+
+	int64_t near = add(&schedule, T0 + 50, 0);
+	int64_t repeat = add(&schedule, T0 + 30, 60);
+	int64_t far = add(&schedule, T0 + 2 * SCHEDULE_RANGE, 0);
+
+	// A jump past the whole wheel places everything again, whatever was passed over fires once
+	int64_t step = T0 + SCHEDULE_RANGE + 100;
+	advance(&schedule, step);
+
+	// The repeat picks up its own rhythm again after the step
+	int64_t next = T0 + 30 + ((step - (T0 + 30)) / 60 + 1) * 60;
+	advance(&schedule, next);
+	schedule_cancel(&schedule, repeat);
+	advance(&schedule, T0 + 2 * SCHEDULE_RANGE);
+
+	uint32_t ids[] = { repeat, near, repeat, far };
+	int64_t seconds[] = { step, step, next, T0 + 2 * SCHEDULE_RANGE };
+	// Both were overdue in the same second, their order within it is not fixed
+	if (fired_count >= 2 && fired[0].id == near)
+	{
+		ids[0] = near;
+		ids[1] = repeat;
+	}
+	int ret = expect("clock_step", ids, seconds, 4);
+
+	schedule_cleanup(&schedule);
+	return ret;
+}
+
+static const struct
+{
+	const char* name;
+	int (*run)();
+} checks[] = {
+	{ "cascade", check_cascade },
+	{ "repeat", check_repeat },
+	{ "reused_id", check_reused_id },
+	{ "restart", check_restart },
+	{ "clock_step", check_clock_step },
+};
+
+int main()
+{
+	int ret = 0;
+
+	for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); ++c)
+	{
+		int ok = checks[c].run() == 0;
+		printf("%s %s\n", checks[c].name, ok ? "ok" : "FAILED");
+		if (!ok)
+			ret = 1;
+	}
+
+	return ret;
+}
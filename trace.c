@@ -0,0 +1,163 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static trace_record_t* trace_slot(const trace_t* trace, uint64_t seq)
+{
+	const trace_header_t* header = trace->header;
+	char* records = (char*)trace->map + sizeof(trace_header_t);
+
+	return (trace_record_t*)(records + (seq % header->capacity) * header->record_size);
+}
+
+int trace_create(trace_t* trace, const char* path, uint32_t pixels, uint32_t capacity)
+{
+	memset(trace, 0, sizeof(trace_t));
+	if (capacity == 0)
+		return -1;
+
+	// Keep records 8 byte aligned for the timestamps
+	uint32_t record_size = (sizeof(trace_record_t) + pixels * sizeof(rgb_t) + 7) & ~7U;
+	size_t len = sizeof(trace_header_t) + (size_t)record_size * capacity;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, len) < 0)
+	{
+		int ret = -errno;
+		fprintf(stderr, "Failed to create trace file %s: %s (%d)\n", path, strerror(-ret), ret);
+		if (fd >= 0)
+			close(fd);
+		return ret;
+	}
+
+	void* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		int ret = -errno;
+		fprintf(stderr, "Failed to map trace file %s: %s (%d)\n", path, strerror(-ret), ret);
+		close(fd);
+		return ret;
+	}
+
+	trace->fd = fd;
+	trace->map = map;
+	trace->map_len = len;
+	trace->header = (trace_header_t*)map;
+
+	trace->header->magic = TRACE_MAGIC;
+	trace->header->version = TRACE_VERSION;
+	trace->header->pixels = pixels;
+	trace->header->capacity = capacity;
+	trace->header->record_size = record_size;
+	trace->header->written = 0;
+
+	return 0;
+}
+
+int trace_open(trace_t* trace, const char* path)
+{
+	memset(trace, 0, sizeof(trace_t));
+
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		int ret = -errno;
+		fprintf(stderr, "Failed to open trace file %s: %s (%d)\n", path, strerror(-ret), ret);
+		if (fd >= 0)
+			close(fd);
+		return ret;
+	}
+
+	if ((size_t)st.st_size < sizeof(trace_header_t))
+	{
+		fprintf(stderr, "%s is not a trace file\n", path);
+		close(fd);
+		return -1;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		int ret = -errno;
+		fprintf(stderr, "Failed to map trace file %s: %s (%d)\n", path, strerror(-ret), ret);
+		close(fd);
+		return ret;
+	}
+
+	trace->fd = fd;
+	trace->map = map;
+	trace->map_len = st.st_size;
+	trace->header = (trace_header_t*)map;
+
+	// Every record has to hold all pixels, and all records have to be in the map
+	const trace_header_t* header = trace->header;
+	if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION || header->capacity == 0
+		|| header->record_size < sizeof(trace_record_t) + (size_t)header->pixels * sizeof(rgb_t)
+		|| sizeof(trace_header_t) + (size_t)header->record_size * header->capacity > trace->map_len)
+	{
+		fprintf(stderr, "%s is not a valid version %d trace file\n", path, TRACE_VERSION);
+		trace_close(trace);
+		return -1;
+	}
+
+	return 0;
+}
+
+void trace_close(trace_t* trace)
+{
+	if (trace->map != NULL)
+		munmap(trace->map, trace->map_len);
+	if (trace->fd > 0)
+		close(trace->fd);
+
+	memset(trace, 0, sizeof(trace_t));
+}
+
+void trace_append(trace_t* trace, const rgb_t* pixels, size_t n)
+{
+	trace_header_t* header = trace->header;
+	uint64_t seq = header->written;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	if (n > header->pixels)
+		n = header->pixels;
+
+	trace_record_t* record = trace_slot(trace, seq);
+	record->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	record->seq = seq;
+	memcpy(record->pixels, pixels, n * sizeof(rgb_t));
+	for (size_t i = n; i < header->pixels && n > 0; ++i)
+		record->pixels[i] = pixels[n - 1];
+
+	// Publish the record only once it is complete, for readers of a live trace
+	__atomic_store_n(&header->written, seq + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t trace_first(const trace_t* trace)
+{
+	uint64_t written = __atomic_load_n(&trace->header->written, __ATOMIC_ACQUIRE);
+	if (written <= trace->header->capacity)
+		return 0;
+
+	return written - trace->header->capacity;
+}
+
+const trace_record_t* trace_get(const trace_t* trace, uint64_t seq)
+{
+	uint64_t written = __atomic_load_n(&trace->header->written, __ATOMIC_ACQUIRE);
+	if (seq >= written || seq < trace_first(trace))
+		return NULL;
+
+	return trace_slot(trace, seq);
+}
@@ -0,0 +1,53 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+
+#define TRACE_MAGIC 0x4352544c
+#define TRACE_VERSION 1
+
+struct _trace_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+
+	uint32_t pixels;
+	uint32_t capacity;
+	uint32_t record_size;
+	uint32_t reserved;
+
+	// Frames ever written, the next one lands in slot written % capacity
+	uint64_t written;
+};
+typedef struct _trace_header_t trace_header_t;
+
+struct _trace_record_t
+{
+	uint64_t timestamp_ns;
+	uint64_t seq;
+	rgb_t pixels[];
+};
+typedef struct _trace_record_t trace_record_t;
+
+struct _trace_t
+{
+	int fd;
+	void* map;
+	size_t map_len;
+
+	trace_header_t* header;
+};
+typedef struct _trace_t trace_t;
+
+int trace_create(trace_t*, const char* path, uint32_t pixels, uint32_t capacity);
+int trace_open(trace_t*, const char* path);
+void trace_close(trace_t*);
+
+void trace_append(trace_t*, const rgb_t* pixels, size_t n);
+
+uint64_t trace_first(const trace_t*);
+const trace_record_t* trace_get(const trace_t*, uint64_t seq);
+
+#endif